@@ -19,6 +19,8 @@
  *   - Set hidden visibility on all symbols by default.
  * 2020-05-16  Russ Allbery <eagle@eyrie.org>
  *   - Cast CRACK_TOLOWER and CRACK_TOUPPER to char.
+ * 2026-10-18  Russ Allbery <eagle@eyrie.org>
+ *   - Declare FindPWProbes.
  */
 
 #include <config.h>
@@ -73,6 +75,7 @@ typedef struct
 
 extern PWDICT *PWOpen(const char *, const char *);
 extern int32 FindPW(PWDICT *, const char *);
+extern unsigned long FindPWProbes;
 extern int PutPW(PWDICT *, const char *);
 extern int PWClose(PWDICT *);
 extern char *Mangle(const char *, const char *);
@@ -30,6 +30,9 @@
  *   - Remove unused vers_id to silence GCC warnings.
  * 2020-05-16  Russ Allbery <eagle@eyrie.org>
  *   - Fix types of printf formatting directives in DEBUG conditionals.
+ * 2026-10-18  Russ Allbery <eagle@eyrie.org>
+ *   - Add a static tracepoint to FindPW reporting the number of probes.
+ *   - Count the words compared by FindPW in FindPWProbes.
  */
 
 #include <stdio.h>
@@ -37,6 +40,17 @@
 
 #include "packer.h"
 
+#ifdef HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+# define FINDPW_PROBE(probes, result) \
+    DTRACE_PROBE2(krb5_strength, cracklib_findpw, probes, result)
+#else
+# define FINDPW_PROBE(probes, result) ((void) (probes), (void) (result))
+#endif
+
+/* Total number of words compared by FindPW, for reporting slow checks. */
+unsigned long FindPWProbes = 0;
+
 PWDICT *
 PWOpen(const char *prefix, const char *mode)
 {
@@ -333,6 +347,7 @@ FindPW(PWDICT *pwp, const char *string)
     register int32 middle;
     register char *this;
     int idx;
+    int probes = 0;
 
     if (pwp->flags & PFOR_USEHWMS)
     {
@@ -358,6 +373,8 @@ FindPW(PWDICT *pwp, const char *string)
 #endif
 
 	middle = lwm + ((hwm - lwm + 1) / 2);
+	probes++;
+	FindPWProbes++;
 
 	/*
 	 * If GetPW returns NULL, we have a corrupt dictionary.	 It's hard to
@@ -367,6 +384,7 @@ FindPW(PWDICT *pwp, const char *string)
 	this = GetPW(pwp, middle);
 	if (this == NULL)
 	{
+	    FINDPW_PROBE(probes, 1);
 	    return (middle);
 	}
 	cmp = strcmp(string, this);		/* INLINE ? */
@@ -395,9 +413,11 @@ FindPW(PWDICT *pwp, const char *string)
 	   lwm = middle + 1;
 	} else
 	{
+	    FINDPW_PROBE(probes, 1);
 	    return (middle);
 	}
     }
 
+    FINDPW_PROBE(probes, 0);
     return (PW_WORDS(pwp));
 }
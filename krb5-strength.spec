@@ -30,6 +30,10 @@ BuildRequires: ncurses-devel
 %endif
 BuildRequires: sqlite-devel
 BuildRequires: tinycdb-devel
+%if %{with history}
+BuildRequires: libdb-devel
+BuildRequires: openssl-devel
+%endif
 
 Requires: perl(autodie)
 Requires: perl(Getopt::Long)
@@ -75,8 +79,8 @@ export PATH_KRB5_CONFIG=/usr/bin/heimdal-krb5-config
 %install
 %make_install
 %if !%{with history}
-rm -f $RPM_BUILD_ROOT%{_bindir}/heimdal-history
-rm -f $RPM_BUILD_ROOT%{_mandir}/man1/heimdal-history.*
+rm -f $RPM_BUILD_ROOT%{_bindir}/heimdal-history*
+rm -f $RPM_BUILD_ROOT%{_mandir}/man1/heimdal-history*
 %endif
 
 %files
@@ -84,8 +88,12 @@ rm -f $RPM_BUILD_ROOT%{_mandir}/man1/heimdal-history.*
 %license LICENSE
 %doc README
 %{_bindir}/heimdal-strength
+%{_bindir}/krb5-strength-audit
+%{_bindir}/krb5-strength-stats
 %{_bindir}/krb5-strength-wordlist
 %{_mandir}/man1/heimdal-strength.*
+%{_mandir}/man1/krb5-strength-audit.*
+%{_mandir}/man1/krb5-strength-stats.*
 %{_mandir}/man1/krb5-strength-wordlist.*
 %{_mandir}/man5
 %{_libdir}/krb5/plugins/pwqual/strength.so
@@ -95,7 +103,9 @@ rm -f $RPM_BUILD_ROOT%{_mandir}/man1/heimdal-history.*
 %files -n %{name}-history
 %defattr(-,root,root)
 %{_bindir}/heimdal-history
+%{_bindir}/heimdal-history-native
 %{_mandir}/man1/heimdal-history.*
+%{_mandir}/man1/heimdal-history-native.*
 %endif
 
 %changelog
@@ -0,0 +1,175 @@
+/*
+ * Single-pass analysis of a password.
+ *
+ * The simple password checks (length, printable ASCII, letters and spaces
+ * only, minimum number of different characters, and character classes) all
+ * need to look at every character of the password.  Rather than have each of
+ * them walk the password separately, this file computes a summary of the
+ * password in one scan that all of the checks then use, so enabling more of
+ * those checks costs almost nothing.
+ *
+ * On x86 systems, the classification is done 16 bytes at a time with SSE2.
+ * ASCII characters are classified by their fixed ranges, which match what
+ * the ctype functions return for them in any locale.  Any block containing a
+ * byte with the high bit set is instead classified a byte at a time with the
+ * ctype functions so that the results still honor the current locale.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <ctype.h>
+
+#include <plugin/internal.h>
+#include <util/macros.h>
+
+/* Use SSE2 if building for x86 with a compiler that supports intrinsics. */
+#if defined(__GNUC__) && defined(__SSE2__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#    define HAVE_ANALYZE_SSE2 1
+#    include <emmintrin.h>
+#endif
+
+
+/*
+ * Classify a single byte of the password with the ctype functions, updating
+ * the character classes and flags in the summary.
+ */
+static void
+analyze_byte(unsigned char c, struct password_info *info)
+{
+    if (!isascii(c) || !isprint(c))
+        info->printable = false;
+    if (!isalpha(c) && c != ' ')
+        info->alpha_space = false;
+    if (islower(c))
+        info->classes |= CLASS_LOWER;
+    else if (isupper(c))
+        info->classes |= CLASS_UPPER;
+    else if (isdigit(c))
+        info->classes |= CLASS_DIGIT;
+    else
+        info->classes |= CLASS_SYMBOL;
+}
+
+
+#ifdef HAVE_ANALYZE_SSE2
+
+/*
+ * Return a mask of the bytes in v that are between low and high inclusive.
+ * Only valid if no byte in v has the high bit set, since the comparisons are
+ * signed.
+ */
+static inline __m128i
+in_range(__m128i v, char low, char high)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((char) (low - 1))),
+                         _mm_cmpgt_epi8(_mm_set1_epi8((char) (high + 1)), v));
+}
+
+
+/*
+ * Classify a block of up to 16 bytes of ASCII characters, updating the
+ * character classes and flags in the summary.  A short final block is copied
+ * into a padded buffer so that we never read past the end of the password,
+ * and the padding is masked out of the results.  Returns false without
+ * changing anything if any byte in the block has the high bit set.
+ */
+static bool
+analyze_block(const char *p, size_t count, struct password_info *info)
+{
+    char buffer[16] = {0};
+    __m128i v, lower, upper, digit, print, alpha_space, alnum;
+    int valid;
+
+    if (count < 16) {
+        memcpy(buffer, p, count);
+        p = buffer;
+    }
+    valid = (int) ((1U << count) - 1);
+    v = _mm_loadu_si128((const __m128i *) (const void *) p);
+    if ((_mm_movemask_epi8(v) & valid) != 0)
+        return false;
+    lower = in_range(v, 'a', 'z');
+    upper = in_range(v, 'A', 'Z');
+    digit = in_range(v, '0', '9');
+    print = in_range(v, ' ', '~');
+    alpha_space = _mm_or_si128(_mm_or_si128(lower, upper),
+                               _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+    alnum = _mm_or_si128(_mm_or_si128(lower, upper), digit);
+    if ((_mm_movemask_epi8(print) & valid) != valid)
+        info->printable = false;
+    if ((_mm_movemask_epi8(alpha_space) & valid) != valid)
+        info->alpha_space = false;
+    if ((_mm_movemask_epi8(lower) & valid) != 0)
+        info->classes |= CLASS_LOWER;
+    if ((_mm_movemask_epi8(upper) & valid) != 0)
+        info->classes |= CLASS_UPPER;
+    if ((_mm_movemask_epi8(digit) & valid) != 0)
+        info->classes |= CLASS_DIGIT;
+    if ((_mm_movemask_epi8(alnum) & valid) != valid)
+        info->classes |= CLASS_SYMBOL;
+    explicit_bzero(buffer, sizeof(buffer));
+    return true;
+}
+
+#endif /* HAVE_ANALYZE_SSE2 */
+
+
+/*
+ * Analyze a password and fill out the summary used by the simple checks.
+ */
+void
+strength_analyze(const char *password, struct password_info *info)
+{
+    const unsigned char *p;
+    size_t i, length;
+    unsigned int bit;
+    uint64_t word;
+
+    memset(info, 0, sizeof(*info));
+    length = strlen(password);
+    info->length = length;
+    info->printable = true;
+    info->alpha_space = true;
+    p = (const unsigned char *) password;
+
+    /*
+     * Classify the password a block at a time where possible and a byte at a
+     * time otherwise.  The set of bytes seen is updated for every byte as we
+     * go.
+     */
+#ifdef HAVE_ANALYZE_SSE2
+    for (i = 0; i < length; i += 16) {
+        size_t j, count;
+
+        count = (length - i < 16) ? length - i : 16;
+        if (analyze_block(password + i, count, info))
+            for (j = i; j < i + count; j++)
+                info->seen[p[j] >> 6] |= UINT64_C(1) << (p[j] & 63);
+        else
+            for (j = i; j < i + count; j++) {
+                analyze_byte(p[j], info);
+                info->seen[p[j] >> 6] |= UINT64_C(1) << (p[j] & 63);
+            }
+    }
+#else
+    for (i = 0; i < length; i++) {
+        analyze_byte(p[i], info);
+        info->seen[p[i] >> 6] |= UINT64_C(1) << (p[i] & 63);
+    }
+#endif
+
+    /* Summarize the classes and the set of different bytes. */
+    for (bit = CLASS_LOWER; bit <= CLASS_SYMBOL; bit <<= 1)
+        if (info->classes & bit)
+            info->num_classes++;
+    for (i = 0; i < ARRAY_SIZE(info->seen); i++)
+        for (word = info->seen[i]; word != 0; word &= word - 1)
+            info->unique++;
+}
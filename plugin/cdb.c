@@ -9,6 +9,7 @@
  * character from both start and end.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2013
  *     The Board of Trustees of the Leland Stanford Junior University
  *
@@ -36,12 +37,13 @@
  */
 #ifndef HAVE_CDB
 krb5_error_code
-strength_init_cdb(krb5_context ctx, krb5_pwqual_moddata data UNUSED)
+strength_init_cdb(krb5_context ctx, krb5_pwqual_moddata data)
 {
     char *path = NULL;
 
     /* Get CDB dictionary path from krb5.conf. */
-    strength_config_string(ctx, "password_dictionary_cdb", &path);
+    strength_config_string(ctx, data->config, "password_dictionary_cdb",
+                           &path);
 
     /* If it was set, report an error, since we don't have CDB support. */
     if (path == NULL)
@@ -59,18 +61,19 @@ strength_init_cdb(krb5_context ctx, krb5_pwqual_moddata data UNUSED)
 #ifdef HAVE_CDB
 
 /*
- * Look up a password in CDB and set the found parameter to true if it is
- * found, false otherwise.  Returns a Kerberos status code, which will be 0 on
- * success and something else on failure.
+ * Look up a password of the given length, which need not be nul-terminated,
+ * in CDB and set the found parameter to true if it is found, false otherwise.
+ * Returns a Kerberos status code, which will be 0 on success and something
+ * else on failure.
  */
 static krb5_error_code
-in_cdb_dictionary(krb5_context ctx, krb5_pwqual_moddata data,
-                  const char *password, bool *found)
+in_cdb_dictionary(krb5_context ctx, struct cdb *cdb, const char *password,
+                  size_t length, bool *found)
 {
     int status;
 
     *found = false;
-    status = cdb_find(&data->cdb, password, (unsigned int) strlen(password));
+    status = cdb_find(cdb, password, (unsigned int) length);
     if (status < 0)
         return strength_error_system(ctx, "cannot query CDB database");
     else {
@@ -80,121 +83,165 @@ in_cdb_dictionary(krb5_context ctx, krb5_pwqual_moddata data,
 }
 
 
+/*
+ * Open the CDB dictionary and set up the TinyCDB state.  Returns 0 on success,
+ * non-zero on failure (and sets the error in the Kerberos context).
+ */
+static krb5_error_code
+open_cdb(krb5_context ctx, krb5_pwqual_moddata data)
+{
+    krb5_error_code code;
+
+    data->cdb_fd = open(data->cdb_path, O_RDONLY);
+    if (data->cdb_fd < 0)
+        return strength_error_system(ctx, "cannot open dictionary %s",
+                                     data->cdb_path);
+    if (cdb_init(&data->cdb, data->cdb_fd) < 0) {
+        code = strength_error_system(ctx, "cannot init dictionary %s",
+                                     data->cdb_path);
+        close(data->cdb_fd);
+        data->cdb_fd = -1;
+        return code;
+    }
+    data->have_cdb = true;
+    return 0;
+}
+
+
 /*
  * Initialize the CDB dictionary.  Opens the dictionary and sets up the
- * TinyCDB state.  Returns 0 on success, non-zero on failure (and sets the
- * error in the Kerberos context).  If not built with CDB support, always
- * returns an error.
+ * TinyCDB state, or if lazy initialization was requested, only checks that
+ * the dictionary is readable and leaves opening it to the first check.
+ * Returns 0 on success, non-zero on failure (and sets the error in the
+ * Kerberos context).  If not built with CDB support, always returns an
+ * error.
  */
 krb5_error_code
 strength_init_cdb(krb5_context ctx, krb5_pwqual_moddata data)
 {
     krb5_error_code code;
-    char *path = NULL;
 
     /* Get CDB dictionary path from krb5.conf. */
-    strength_config_string(ctx, "password_dictionary_cdb", &path);
+    strength_config_string(ctx, data->config, "password_dictionary_cdb",
+                           &data->cdb_path);
 
     /* If there is no configured dictionary, nothing to do. */
-    if (path == NULL)
+    if (data->cdb_path == NULL)
         return 0;
 
-    /* Open the dictionary and initialize the CDB data. */
-    data->cdb_fd = open(path, O_RDONLY);
-    if (data->cdb_fd < 0)
-        return strength_error_system(ctx, "cannot open dictionary %s", path);
-    if (cdb_init(&data->cdb, data->cdb_fd) < 0) {
-        code = strength_error_system(ctx, "cannot init dictionary %s", path);
-        free(path);
-        close(data->cdb_fd);
-        data->cdb_fd = -1;
-        return code;
+    /* Open the dictionary, or just check it if opening it lazily. */
+    if (data->lazy) {
+        if (access(data->cdb_path, R_OK) != 0)
+            return strength_error_system(ctx, "cannot read dictionary %s",
+                                         data->cdb_path);
+    } else {
+        code = open_cdb(ctx, data);
+        if (code != 0)
+            return code;
     }
-    free(path);
-    data->have_cdb = true;
-    return 0;
+
+    /* Note the dictionary so that callers can tell if it is replaced. */
+    return strength_watch(ctx, data, data->cdb_path);
 }
 
 
 /*
  * Macro used to make password checks more readable.  Assumes that the found
  * and fail labels are available for the abort cases of finding a password or
- * failing to look it up.
+ * failing to look it up, and counts the lookups.
  */
-#    define CHECK_PASSWORD(ctx, data, password)                    \
-        do {                                                       \
-            code = in_cdb_dictionary(ctx, data, password, &found); \
-            if (code != 0)                                         \
-                goto fail;                                         \
-            if (found)                                             \
-                goto found;                                        \
+#    define CHECK_PASSWORD(ctx, cdb, password, length)                    \
+        do {                                                              \
+            (*lookups)++;                                                 \
+            code = in_cdb_dictionary(ctx, cdb, password, length, &found); \
+            if (code != 0)                                                \
+                goto fail;                                                \
+            if (found)                                                    \
+                goto found;                                               \
         } while (0)
 
 
 /*
  * Given a password, try the various transformations that we want to apply and
- * check for each of them in the dictionary.  Returns a Kerberos status code,
- * which will be KADM5_PASS_Q_DICT if the password was found in the
- * dictionary.
+ * check for each of them in an open CDB dictionary, adding the number of
+ * lookups to lookups.  Each variant is a substring of the password, so they
+ * are looked up by offset and length without making copies.  Returns a
+ * Kerberos status code, which will be KADM5_PASS_Q_DICT if the password was
+ * found in the dictionary.
  */
 krb5_error_code
-strength_check_cdb(krb5_context ctx, krb5_pwqual_moddata data,
-                   const char *password)
+strength_cdb_check(krb5_context ctx, struct cdb *cdb, const char *password,
+                   unsigned long *lookups)
 {
     krb5_error_code code;
     bool found;
-    char *variant = NULL;
-
-    /* If we have no dictionary, there is nothing to do. */
-    if (!data->have_cdb)
-        return 0;
+    size_t length;
 
     /* Check the basic password. */
-    CHECK_PASSWORD(ctx, data, password);
+    length = strlen(password);
+    STRENGTH_PROBE1(cdb_entry, length);
+    CHECK_PASSWORD(ctx, cdb, password, length);
 
     /* Check with one or two characters removed from the start. */
-    if (password[0] != '\0') {
-        CHECK_PASSWORD(ctx, data, password + 1);
-        if (password[1] != '\0')
-            CHECK_PASSWORD(ctx, data, password + 2);
+    if (length > 0) {
+        CHECK_PASSWORD(ctx, cdb, password + 1, length - 1);
+        if (length > 1)
+            CHECK_PASSWORD(ctx, cdb, password + 2, length - 2);
     }
 
     /*
      * Strip a character from the end and then check both that password and
      * the one with a character taken from the start as well.
      */
-    if (strlen(password) > 0) {
-        variant = strdup(password);
-        if (variant == NULL)
-            return strength_error_system(ctx, "cannot allocate memory");
-        variant[strlen(variant) - 1] = '\0';
-        CHECK_PASSWORD(ctx, data, variant);
-        if (variant[0] != '\0')
-            CHECK_PASSWORD(ctx, data, variant + 1);
+    if (length > 0) {
+        CHECK_PASSWORD(ctx, cdb, password, length - 1);
+        if (length > 1)
+            CHECK_PASSWORD(ctx, cdb, password + 1, length - 2);
 
         /* Check the password with two characters removed. */
-        if (strlen(password) > 1) {
-            variant[strlen(variant) - 1] = '\0';
-            CHECK_PASSWORD(ctx, data, variant);
-        }
+        if (length > 1)
+            CHECK_PASSWORD(ctx, cdb, password, length - 2);
     }
 
     /* Password not found. */
-    free(variant);
+    STRENGTH_PROBE2(cdb_return, 0, *lookups);
     return 0;
 
 found:
     /* We found the password or a variant in the dictionary. */
-    free(variant);
-    return strength_error_dict(ctx, ERROR_DICT);
+    code = strength_error_dict(ctx, ERROR_DICT);
 
 fail:
     /* Some sort of failure during CDB lookup. */
-    free(variant);
+    STRENGTH_PROBE2(cdb_return, code, *lookups);
     return code;
 }
 
 
+/*
+ * Check a password against the CDB dictionary of the module data, if there is
+ * one, opening it first if that was deferred.  Returns a Kerberos status code,
+ * which will be KADM5_PASS_Q_DICT if the password was found in the
+ * dictionary.
+ */
+krb5_error_code
+strength_check_cdb(krb5_context ctx, krb5_pwqual_moddata data,
+                   const char *password)
+{
+    krb5_error_code code;
+
+    data->cdb_lookups = 0;
+    if (data->cdb_path == NULL)
+        return 0;
+    if (!data->have_cdb) {
+        code = open_cdb(ctx, data);
+        if (code != 0)
+            return code;
+    }
+    return strength_cdb_check(ctx, &data->cdb, password, &data->cdb_lookups);
+}
+
+
 /*
  * Free internal TinyCDB state and close the CDB dictionary.
  */
@@ -205,6 +252,7 @@ strength_close_cdb(krb5_context ctx UNUSED, krb5_pwqual_moddata data)
         cdb_free(&data->cdb);
     if (data->cdb_fd != -1)
         close(data->cdb_fd);
+    free(data->cdb_path);
 }
 
 #endif /* HAVE_CDB */
@@ -1,10 +1,12 @@
 /*
  * Password strength checks for character classes.
  *
- * Checks whether the password satisfies a set of character class rules.
+ * Checks whether the password satisfies a set of character class rules.  The
+ * rules are compiled at initialization into a table indexed by password
+ * length so that most checks are a single lookup and mask comparison.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
- * Copyright 2016, 2023 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2016, 2023, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2013-2014
  *     The Board of Trustees of the Leland Stanford Junior University
  *
@@ -14,71 +16,135 @@
 #include <config.h>
 #include <portable/system.h>
 
-#include <ctype.h>
-
 #include <plugin/internal.h>
 
-/* Stores the characteristics of a particular password as boolean flags. */
-struct password_classes {
-    bool lower;
-    bool upper;
-    bool digit;
-    bool symbol;
-    unsigned long num_classes;
-};
+/*
+ * The largest password length given its own entry in the table of rules by
+ * password length.  Longer passwords share the last entry.
+ */
+#define CLASS_TABLE_LIMIT 256
+
+
+/*
+ * Return the mask of CLASS_* bits required by a rule.
+ */
+static unsigned int
+rule_mask(const struct class_rule *rule)
+{
+    unsigned int mask = 0;
+
+    if (rule->lower)
+        mask |= CLASS_LOWER;
+    if (rule->upper)
+        mask |= CLASS_UPPER;
+    if (rule->digit)
+        mask |= CLASS_DIGIT;
+    if (rule->symbol)
+        mask |= CLASS_SYMBOL;
+    return mask;
+}
 
 
 /*
- * Analyze a password and fill out a struct with flags indicating which
- * character classes are present in the password.
+ * Return whether a rule applies to passwords of the given length.
  */
-static void
-analyze_password(const char *password, struct password_classes *classes)
+static bool
+rule_applies(const struct class_rule *rule, size_t length)
 {
-    const char *p;
-
-    memset(classes, 0, sizeof(struct password_classes));
-    for (p = password; *p != '\0'; p++) {
-        if (islower((unsigned char) *p))
-            classes->lower = true;
-        else if (isupper((unsigned char) *p))
-            classes->upper = true;
-        else if (isdigit((unsigned char) *p))
-            classes->digit = true;
-        else
-            classes->symbol = true;
+    return length >= rule->min && (rule->max == 0 || length <= rule->max);
+}
+
+
+/*
+ * Return whether a rule applies to any password of at least the given length.
+ */
+static bool
+rule_applies_from(const struct class_rule *rule, size_t length)
+{
+    return rule->max == 0 || length <= rule->max;
+}
+
+
+/*
+ * Load the character class rules from krb5.conf and compile them into a
+ * table indexed by password length.  Each entry combines every rule that
+ * applies to passwords of that length into a single mask of required
+ * classes and a minimum number of classes.
+ *
+ * The last entry covers all longer lengths and combines every rule that
+ * applies to any of them.  The table only needs to be as large as the
+ * largest bound in any rule plus two, but is capped at CLASS_TABLE_LIMIT plus
+ * two.  If a bound is larger than that, the last entry may require more than
+ * the rules for a particular length do, but passwords that don't satisfy a
+ * table entry are checked against each rule anyway.  Returns 0 on success or
+ * a Kerberos error code on failure.
+ */
+krb5_error_code
+strength_init_classes(krb5_context ctx, krb5_pwqual_moddata data)
+{
+    struct class_rule *rule;
+    struct class_entry *entry;
+    krb5_error_code code;
+    unsigned long bound = 0;
+    size_t i;
+    bool last;
+
+    /* Load the rules.  If there are none, there's nothing to compile. */
+    code = strength_config_classes(ctx, data->config, "require_classes",
+                                   &data->rules);
+    if (code != 0 || data->rules == NULL)
+        return code;
+
+    /* Find the size of the table, capped at the limit. */
+    for (rule = data->rules; rule != NULL; rule = rule->next) {
+        if (rule->min > bound)
+            bound = rule->min;
+        if (rule->max > bound)
+            bound = rule->max;
+    }
+    if (bound > CLASS_TABLE_LIMIT)
+        bound = CLASS_TABLE_LIMIT;
+
+    /* Build the table. */
+    data->class_table_size = bound + 2;
+    data->class_table = calloc(data->class_table_size, sizeof(*entry));
+    if (data->class_table == NULL)
+        return strength_error_system(ctx, "cannot allocate memory");
+    for (i = 0; i < data->class_table_size; i++) {
+        entry = &data->class_table[i];
+        last = (i == data->class_table_size - 1);
+        for (rule = data->rules; rule != NULL; rule = rule->next) {
+            if (last ? !rule_applies_from(rule, i) : !rule_applies(rule, i))
+                continue;
+            entry->required |= rule_mask(rule);
+            if (rule->num_classes > entry->num_classes)
+                entry->num_classes = rule->num_classes;
+        }
     }
-    if (classes->lower)
-        classes->num_classes++;
-    if (classes->upper)
-        classes->num_classes++;
-    if (classes->digit)
-        classes->num_classes++;
-    if (classes->symbol)
-        classes->num_classes++;
+    return 0;
 }
 
 
 /*
  * Check whether a password satisfies a required character class rule, given
- * the length of the password and the classes.  Returns 0 if it does and a
- * Kerberos error code if it does not.
+ * the summary of the password.  Returns 0 if it does and a Kerberos error
+ * code if it does not.
  */
 static krb5_error_code
-check_rule(krb5_context ctx, struct class_rule *rule, size_t length,
-           const struct password_classes *classes)
+check_rule(krb5_context ctx, struct class_rule *rule,
+           const struct password_info *info)
 {
-    if (length < rule->min || (rule->max > 0 && length > rule->max))
+    if (!rule_applies(rule, info->length))
         return 0;
-    if (classes->num_classes < rule->num_classes)
+    if (info->num_classes < rule->num_classes)
         return strength_error_class(ctx, ERROR_CLASS_MIN, rule->num_classes);
-    if (rule->lower && !classes->lower)
+    if (rule->lower && !(info->classes & CLASS_LOWER))
         return strength_error_class(ctx, ERROR_CLASS_LOWER);
-    if (rule->upper && !classes->upper)
+    if (rule->upper && !(info->classes & CLASS_UPPER))
         return strength_error_class(ctx, ERROR_CLASS_UPPER);
-    if (rule->digit && !classes->digit)
+    if (rule->digit && !(info->classes & CLASS_DIGIT))
         return strength_error_class(ctx, ERROR_CLASS_DIGIT);
-    if (rule->symbol && !classes->symbol)
+    if (rule->symbol && !(info->classes & CLASS_SYMBOL))
         return strength_error_class(ctx, ERROR_CLASS_SYMBOL);
     return 0;
 }
@@ -86,23 +152,33 @@ check_rule(krb5_context ctx, struct class_rule *rule, size_t length,
 
 /*
  * Check whether a password satisfies the configured character class
- * restrictions.
+ * restrictions, given the summary of the password from strength_analyze.
+ *
+ * If we have a table of rules by length, a password that satisfies the
+ * table entry for its length satisfies every rule, which is the common case.
+ * Otherwise, walk the rules in order so that the error reported is the same
+ * as the first rule that fails.
  */
 krb5_error_code
 strength_check_classes(krb5_context ctx, krb5_pwqual_moddata data,
-                       const char *password)
+                       const struct password_info *info)
 {
-    struct password_classes classes;
-    size_t length;
+    const struct class_entry *entry;
     struct class_rule *rule;
     krb5_error_code code;
+    size_t i;
 
-    if (data->rules == NULL)
-        return 0;
-    analyze_password(password, &classes);
-    length = strlen(password);
+    if (data->class_table != NULL) {
+        i = info->length;
+        if (i >= data->class_table_size)
+            i = data->class_table_size - 1;
+        entry = &data->class_table[i];
+        if ((info->classes & entry->required) == entry->required
+            && info->num_classes >= entry->num_classes)
+            return 0;
+    }
     for (rule = data->rules; rule != NULL; rule = rule->next) {
-        code = check_rule(ctx, rule, length, &classes);
+        code = check_rule(ctx, rule, info);
         if (code != 0)
             return code;
     }
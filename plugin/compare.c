@@ -0,0 +1,347 @@
+/*
+ * Common prefix and suffix lengths for dictionary matching.
+ *
+ * The SQLite dictionary check compares the password against every word in a
+ * range of the dictionary and needs the length of the common prefix and
+ * common suffix of the two strings for each.  On large ranges, this
+ * comparison is most of the CPU time of a check, so on x86 systems it is
+ * done 16 bytes at a time with SSE2 or 32 bytes at a time with AVX2,
+ * depending on what the CPU supports.  The implementation is chosen at
+ * runtime, and a portable byte-by-byte version is used everywhere else.
+ *
+ * All of these functions take explicit lengths and never read past them, so
+ * neither string needs to be nul-terminated.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <pthread.h>
+
+#include <plugin/internal.h>
+
+/*
+ * Only use the vector implementations if we're building for x86 with a
+ * compiler that supports the intrinsics, per-function target attributes, and
+ * runtime CPU detection.  SSE2 is part of the base instruction set on x86_64,
+ * so we only need to check at runtime for AVX2.
+ */
+#if defined(__GNUC__) && defined(__SSE2__) \
+    && (defined(__x86_64__) || defined(__i386__))
+#    define HAVE_COMPARE_SIMD 1
+#    include <immintrin.h>
+#endif
+
+/* Signature of the implementations of each function. */
+typedef size_t (*compare_func)(const char *, size_t, const char *, size_t);
+
+/*
+ * The implementations currently in use, chosen once on first use by
+ * compare_init so that threads doing checks never race with the choice.
+ */
+static compare_func prefix_func = NULL;
+static compare_func suffix_func = NULL;
+static pthread_once_t compare_once = PTHREAD_ONCE_INIT;
+
+
+/*
+ * Return the length of the common prefix of two strings, one byte at a time.
+ */
+static size_t
+prefix_scalar(const char *a, size_t alen, const char *b, size_t blen)
+{
+    size_t i;
+    size_t length = (alen < blen) ? alen : blen;
+
+    for (i = 0; i < length && a[i] == b[i]; i++)
+        ;
+    return i;
+}
+
+
+/*
+ * Return the length of the common suffix of two strings, one byte at a time.
+ */
+static size_t
+suffix_scalar(const char *a, size_t alen, const char *b, size_t blen)
+{
+    size_t i;
+    size_t length = (alen < blen) ? alen : blen;
+
+    for (i = 0; i < length && a[alen - i - 1] == b[blen - i - 1]; i++)
+        ;
+    return i;
+}
+
+
+#ifdef HAVE_COMPARE_SIMD
+
+/*
+ * Finish a prefix comparison of fewer than 16 bytes.  Comparing eight bytes
+ * at a time as integers is considerably faster than the byte loop for the
+ * short passwords that are the common case.  x86 is little-endian, so the
+ * lowest set bit of the exclusive or is the first difference.
+ */
+static inline size_t
+prefix_tail(const char *a, const char *b, size_t length)
+{
+    uint64_t wa, wb;
+    size_t i = 0;
+
+    if (length >= 8) {
+        memcpy(&wa, a, sizeof(wa));
+        memcpy(&wb, b, sizeof(wb));
+        if (wa != wb)
+            return (size_t) __builtin_ctzll(wa ^ wb) / 8;
+        i = 8;
+    }
+    for (; i < length && a[i] == b[i]; i++)
+        ;
+    return i;
+}
+
+
+/*
+ * Finish a suffix comparison of fewer than 16 bytes, given pointers to the
+ * ends of the strings.  The highest set bit of the exclusive or is the first
+ * difference from the end.
+ */
+static inline size_t
+suffix_tail(const char *aend, const char *bend, size_t length)
+{
+    uint64_t wa, wb;
+    size_t i = 0;
+
+    if (length >= 8) {
+        memcpy(&wa, aend - 8, sizeof(wa));
+        memcpy(&wb, bend - 8, sizeof(wb));
+        if (wa != wb)
+            return (size_t) __builtin_clzll(wa ^ wb) / 8;
+        i = 8;
+    }
+    for (; i < length && aend[-(ptrdiff_t) i - 1] == bend[-(ptrdiff_t) i - 1];
+         i++)
+        ;
+    return i;
+}
+
+
+/*
+ * Return the length of the common prefix of two strings, 16 bytes at a time.
+ * Each block of the two strings is compared for equality, giving a bitmask
+ * with one bit per matching byte, and the first clear bit is the first
+ * difference.
+ */
+static size_t
+prefix_sse2(const char *a, size_t alen, const char *b, size_t blen)
+{
+    size_t i;
+    size_t length = (alen < blen) ? alen : blen;
+    __m128i va, vb;
+    unsigned int mask;
+
+    for (i = 0; i + 16 <= length; i += 16) {
+        va = _mm_loadu_si128((const __m128i *) (const void *) (a + i));
+        vb = _mm_loadu_si128((const __m128i *) (const void *) (b + i));
+        mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+        if (mask != 0xffff)
+            return i + (size_t) __builtin_ctz(~mask);
+    }
+    return i + prefix_tail(a + i, b + i, length - i);
+}
+
+
+/*
+ * Return the length of the common suffix of two strings, 16 bytes at a time.
+ * This works like prefix_sse2 but from the ends of the strings, so the last
+ * clear bit in the mask is the first difference.
+ */
+static size_t
+suffix_sse2(const char *a, size_t alen, const char *b, size_t blen)
+{
+    size_t i;
+    size_t length = (alen < blen) ? alen : blen;
+    const char *aend = a + alen;
+    const char *bend = b + blen;
+    __m128i va, vb;
+    unsigned int mask;
+
+    for (i = 0; i + 16 <= length; i += 16) {
+        va = _mm_loadu_si128((const __m128i *) (const void *) (aend - i - 16));
+        vb = _mm_loadu_si128((const __m128i *) (const void *) (bend - i - 16));
+        mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+        if (mask != 0xffff)
+            return i + (size_t) __builtin_clz(~mask << 16);
+    }
+    return i + suffix_tail(aend - i, bend - i, length - i);
+}
+
+
+/*
+ * Return the length of the common prefix of two strings, 32 bytes at a time.
+ * The same as prefix_sse2 except with wider blocks, finishing with at most
+ * one 16-byte block.
+ */
+__attribute__((__target__("avx2"))) static size_t
+prefix_avx2(const char *a, size_t alen, const char *b, size_t blen)
+{
+    size_t i;
+    size_t length = (alen < blen) ? alen : blen;
+    __m256i va, vb;
+    unsigned int mask;
+
+    for (i = 0; i + 32 <= length; i += 32) {
+        va = _mm256_loadu_si256((const __m256i *) (const void *) (a + i));
+        vb = _mm256_loadu_si256((const __m256i *) (const void *) (b + i));
+        mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (mask != 0xffffffffU)
+            return i + (size_t) __builtin_ctz(~mask);
+    }
+    if (i + 16 <= length) {
+        mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *) (const void *) (a + i)),
+            _mm_loadu_si128((const __m128i *) (const void *) (b + i))));
+        if (mask != 0xffff)
+            return i + (size_t) __builtin_ctz(~mask);
+        i += 16;
+    }
+    return i + prefix_tail(a + i, b + i, length - i);
+}
+
+
+/*
+ * Return the length of the common suffix of two strings, 32 bytes at a time.
+ * The same as suffix_sse2 except with wider blocks, finishing with at most
+ * one 16-byte block.
+ */
+__attribute__((__target__("avx2"))) static size_t
+suffix_avx2(const char *a, size_t alen, const char *b, size_t blen)
+{
+    size_t i;
+    size_t length = (alen < blen) ? alen : blen;
+    const char *aend = a + alen;
+    const char *bend = b + blen;
+    __m256i va, vb;
+    unsigned int mask;
+
+    for (i = 0; i + 32 <= length; i += 32) {
+        va = _mm256_loadu_si256(
+            (const __m256i *) (const void *) (aend - i - 32));
+        vb = _mm256_loadu_si256(
+            (const __m256i *) (const void *) (bend - i - 32));
+        mask = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (mask != 0xffffffffU)
+            return i + (size_t) __builtin_clz(~mask);
+    }
+    if (i + 16 <= length) {
+        mask = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *) (const void *) (aend - i - 16)),
+            _mm_loadu_si128((const __m128i *) (const void *) (bend - i - 16))));
+        if (mask != 0xffff)
+            return i + (size_t) __builtin_clz(~mask << 16);
+        i += 16;
+    }
+    return i + suffix_tail(aend - i, bend - i, length - i);
+}
+
+#endif /* HAVE_COMPARE_SIMD */
+
+
+/*
+ * Set the implementation to use for prefix and suffix comparisons.
+ * STRENGTH_COMPARE_BEST picks the fastest implementation supported by this
+ * CPU.  Returns false if the requested implementation isn't available, in
+ * which case the current implementation is left unchanged.
+ */
+static bool
+compare_set(enum strength_compare impl)
+{
+#ifdef HAVE_COMPARE_SIMD
+    bool have_avx2;
+
+    __builtin_cpu_init();
+    have_avx2 = __builtin_cpu_supports("avx2");
+    if (impl == STRENGTH_COMPARE_BEST)
+        impl = have_avx2 ? STRENGTH_COMPARE_AVX2 : STRENGTH_COMPARE_SSE2;
+    switch (impl) {
+    case STRENGTH_COMPARE_AVX2:
+        if (!have_avx2)
+            return false;
+        prefix_func = prefix_avx2;
+        suffix_func = suffix_avx2;
+        return true;
+    case STRENGTH_COMPARE_SSE2:
+        prefix_func = prefix_sse2;
+        suffix_func = suffix_sse2;
+        return true;
+    case STRENGTH_COMPARE_SCALAR:
+    case STRENGTH_COMPARE_BEST:
+    default:
+        break;
+    }
+#else
+    if (impl == STRENGTH_COMPARE_BEST)
+        impl = STRENGTH_COMPARE_SCALAR;
+#endif
+    if (impl != STRENGTH_COMPARE_SCALAR)
+        return false;
+    prefix_func = prefix_scalar;
+    suffix_func = suffix_scalar;
+    return true;
+}
+
+
+/*
+ * Choose the fastest implementation this CPU supports.  Run once, via
+ * pthread_once, before the first comparison.
+ */
+static void
+compare_init(void)
+{
+    compare_set(STRENGTH_COMPARE_BEST);
+}
+
+
+/*
+ * Override the implementation chosen by compare_init, for the test suite and
+ * benchmarks.  Returns false if the requested implementation isn't available,
+ * in which case the current implementation is left unchanged.
+ *
+ * This is not thread-safe and must not be called while another thread may be
+ * comparing strings.  Normal checks never call it.
+ */
+bool
+strength_compare_select(enum strength_compare impl)
+{
+    pthread_once(&compare_once, compare_init);
+    return compare_set(impl);
+}
+
+
+/*
+ * Return the length of the common prefix of two strings of the given
+ * lengths, choosing the implementation on first use.
+ */
+size_t
+strength_common_prefix(const char *a, size_t alen, const char *b, size_t blen)
+{
+    pthread_once(&compare_once, compare_init);
+    return prefix_func(a, alen, b, blen);
+}
+
+
+/*
+ * Return the length of the common suffix of two strings of the given lengths,
+ * choosing the implementation on first use.
+ */
+size_t
+strength_common_suffix(const char *a, size_t alen, const char *b, size_t blen)
+{
+    pthread_once(&compare_once, compare_init);
+    return suffix_func(a, alen, b, blen);
+}
@@ -5,6 +5,12 @@
  * settings from krb5.conf.  This wraps the somewhat awkward
  * krb5_appdefaults_* functions.
  *
+ * Settings are read through a snapshot created once per initialization of
+ * the module.  The snapshot resolves the realm once and reads each setting
+ * from [appdefaults] at most once, the first time it is asked for, so the
+ * cost of initialization doesn't depend on how many settings are read or how
+ * often.
+ *
  * Written by Russ Allbery <eagle@eyrie.org>
  * Copyright 2016 Russ Allbery <eagle@eyrie.org>
  * Copyright 2013
@@ -33,81 +39,227 @@ typedef krb5_data *realm_type;
 /* Maximum number of character classes. */
 #define MAX_CLASSES 4
 
+/*
+ * All of the settings in the krb5-strength section of [appdefaults], in
+ * sorted order.  A setting must be listed here to be read.
+ */
+static const char *const options[] = {
+    "check_order",
+    "cracklib_maxlen",
+    "debug_init_timing",
+    "language_dictionary_cdb",
+    "language_idle_timeout",
+    "lazy_dictionaries",
+    "minimum_different",
+    "minimum_length",
+    "password_dictionary",
+    "password_dictionary_cdb",
+    "password_dictionary_sqlite",
+    "policies",
+    "reload_interval",
+    "require_ascii_printable",
+    "require_classes",
+    "require_non_letter",
+    "slow_check_threshold_ms",
+    "sqlite_cache_size",
+    "sqlite_immutable",
+    "sqlite_in_memory",
+    "sqlite_mmap_size",
+    "stats_file",
+};
+
+/*
+ * The snapshot of settings.  Each setting is looked up the first time it is
+ * asked for, and values holds the setting or NULL if it is not set or empty.
+ */
+struct strength_config {
+    char *name;                        /* Name of the subsection, if any */
+    realm_type realm;                  /* Realm used for lookups */
+    bool loaded[ARRAY_SIZE(options)];  /* Whether each setting was read */
+    char *values[ARRAY_SIZE(options)]; /* Values of the settings */
+};
+
 
 /*
- * Obtain the default realm and translate it into the format required by
- * krb5_appdefault_*.  This is obnoxious for MIT Kerberos, which returns the
- * default realm as a string but expects the realm as a krb5_data type when
- * calling krb5_appdefault_*.
+ * Translate the name of a realm into the format required by
+ * krb5_appdefault_*.  This is obnoxious for MIT Kerberos, which expects the
+ * realm as a krb5_data type.  The result points into name and must be freed
+ * with free_realm before name is freed.  Returns NULL on allocation failure.
  */
 #ifdef HAVE_KRB5_REALM
 
 static realm_type
-default_realm(krb5_context ctx)
+make_realm(char *name)
 {
-    krb5_error_code code;
-    realm_type realm;
+    return name;
+}
 
-    code = krb5_get_default_realm(ctx, &realm);
-    if (code != 0)
-        realm = NULL;
-    return realm;
+static void
+free_realm(realm_type realm UNUSED)
+{
 }
 
 #else /* !HAVE_KRB5_REALM */
 
 static realm_type
-default_realm(krb5_context ctx)
+make_realm(char *name)
 {
-    char *realm = NULL;
-    krb5_error_code code;
-    krb5_data *realm_data;
+    krb5_data *realm;
 
-    realm_data = calloc(1, sizeof(krb5_data));
-    if (realm_data == NULL)
-        return NULL;
-    code = krb5_get_default_realm(ctx, &realm);
-    if (code != 0) {
-        free(realm_data);
-        return NULL;
-    }
-    realm_data->magic = KV5M_DATA;
-    realm_data->data = strdup(realm);
-    if (realm_data->data == NULL) {
-        free(realm_data);
-        krb5_free_default_realm(ctx, realm);
+    realm = calloc(1, sizeof(krb5_data));
+    if (realm == NULL)
         return NULL;
-    }
-    realm_data->length = (unsigned int) strlen(realm);
-    krb5_free_default_realm(ctx, realm);
-    return realm_data;
+    realm->magic = KV5M_DATA;
+    realm->data = name;
+    realm->length = (unsigned int) strlen(name);
+    return realm;
+}
+
+static void
+free_realm(realm_type realm)
+{
+    free(realm);
 }
 
 #endif /* !HAVE_KRB5_REALM */
 
 
 /*
- * Free the default realm data in whatever form it was generated for the calls
- * to krb5_appdefault_*.
+ * Create a new configuration snapshot for the given subsection, or for the
+ * default realm if section is NULL.  The subsection is passed to
+ * krb5_appdefault_* in place of the realm, so it may be named after a realm
+ * or a kadmin policy.  Returns 0 on success or a Kerberos error code if
+ * memory allocation fails.  A missing default realm is not an error, since
+ * krb5_appdefault_* will then just use the settings that aren't specific to a
+ * realm.
  */
-#ifdef HAVE_KRB5_REALM
+krb5_error_code
+strength_config_open(krb5_context ctx, const char *section,
+                     struct strength_config **config)
+{
+    char *name;
 
-static void
-free_default_realm(krb5_context ctx UNUSED, realm_type realm)
+    *config = calloc(1, sizeof(**config));
+    if (*config == NULL)
+        return strength_error_system(ctx, "cannot allocate memory");
+    if (section != NULL)
+        (*config)->name = strdup(section);
+    else if (krb5_get_default_realm(ctx, &name) == 0) {
+        (*config)->name = strdup(name);
+        krb5_free_default_realm(ctx, name);
+    } else
+        return 0;
+    if ((*config)->name != NULL)
+        (*config)->realm = make_realm((*config)->name);
+    if ((*config)->realm == NULL) {
+        free((*config)->name);
+        free(*config);
+        *config = NULL;
+        return strength_error_system(ctx, "cannot allocate memory");
+    }
+    return 0;
+}
+
+
+/*
+ * Return the name of the subsection of a configuration snapshot, or NULL if
+ * it was created for the default realm and there is no default realm.
+ */
+const char *
+strength_config_section(const struct strength_config *config)
 {
-    krb5_free_default_realm(ctx, realm);
+    return config->name;
 }
 
-#else /* !HAVE_KRB5_REALM */
 
-static void
-free_default_realm(krb5_context ctx UNUSED, realm_type realm)
+/*
+ * Free a configuration snapshot.
+ */
+void
+strength_config_close(krb5_context ctx UNUSED, struct strength_config *config)
 {
-    free(realm->data);
-    free(realm);
+    size_t i;
+
+    if (config == NULL)
+        return;
+    for (i = 0; i < ARRAY_SIZE(options); i++)
+        free(config->values[i]);
+    if (config->realm != NULL)
+        free_realm(config->realm);
+    free(config->name);
+    free(config);
 }
 
-#endif /* !HAVE_KRB5_REALM */
+
+/*
+ * Return the value of a setting from the snapshot, reading it from
+ * [appdefaults] if this is the first time it has been asked for.  Returns
+ * NULL if the setting is not set or is empty.
+ *
+ * This requires an annoying workaround because one cannot specify a default
+ * value of NULL with MIT Kerberos, since MIT Kerberos unconditionally calls
+ * strdup on the default value.  There's also no way to determine if memory
+ * allocation failed while parsing or while setting the default value, so
+ * failures are treated as if the setting were not set.
+ */
+static const char *
+config_value(krb5_context ctx, struct strength_config *config,
+             const char *opt)
+{
+    size_t i;
+    char *value = NULL;
+
+    for (i = 0; i < ARRAY_SIZE(options); i++)
+        if (strcmp(options[i], opt) == 0)
+            break;
+    if (i == ARRAY_SIZE(options))
+        return NULL;
+    if (config->loaded[i])
+        return config->values[i];
+    krb5_appdefault_string(ctx, "krb5-strength", config->realm, opt, "",
+                           &value);
+    if (value != NULL) {
+        if (value[0] != '\0')
+            config->values[i] = strdup(value);
+        krb5_free_string(ctx, value);
+    }
+    config->loaded[i] = true;
+    return config->values[i];
+}
+
+
+/*
+ * Return true if there is a subsection of the settings for the given realm or
+ * kadmin policy, meaning that some setting has a different value when looked
+ * up for that subsection than when looked up without a realm.
+ * krb5_appdefault_* offers no way to ask this directly.  Allocation failures
+ * are treated as if there were no subsection.
+ */
+bool
+strength_config_has_section(krb5_context ctx, const char *section)
+{
+    struct strength_config *config;
+    struct strength_config base;
+    const char *value, *base_value;
+    bool found = false;
+    size_t i;
+
+    if (strength_config_open(ctx, section, &config) != 0)
+        return false;
+    memset(&base, 0, sizeof(base));
+    for (i = 0; i < ARRAY_SIZE(options) && !found; i++) {
+        value = config_value(ctx, config, options[i]);
+        base_value = config_value(ctx, &base, options[i]);
+        if (value == NULL || base_value == NULL)
+            found = (value != base_value);
+        else
+            found = (strcmp(value, base_value) != 0);
+    }
+    for (i = 0; i < ARRAY_SIZE(options); i++)
+        free(base.values[i]);
+    strength_config_close(ctx, config);
+    return found;
+}
 
 
 /*
@@ -131,24 +283,39 @@ parse_number(const char *string, unsigned long *result, const char **end)
 
 
 /*
- * Load a boolean option from Kerberos appdefaults.  Takes the Kerberos
- * context, the option, and the result location.
+ * Load a boolean option from the configuration snapshot.  Takes the Kerberos
+ * context, the snapshot, the option, and the result location.  This accepts
+ * the same values as the krb5_appdefault_boolean of either MIT Kerberos or
+ * Heimdal, and leaves the result unchanged if the value is not recognized.
  */
 void
-strength_config_boolean(krb5_context ctx, const char *opt, bool *result)
+strength_config_boolean(krb5_context ctx, struct strength_config *config,
+                        const char *opt, bool *result)
 {
-    realm_type realm;
-    int tmp;
+    static const char *const yes[] = {"y", "yes", "true", "t", "on"};
+    static const char *const no[] = {"n", "no", "false", "nil", "off"};
+    const char *value;
+    char *end;
+    long number;
+    size_t i;
 
-    /*
-     * The MIT version of krb5_appdefault_boolean takes an int * and the
-     * Heimdal version takes a krb5_boolean *, so hope that Heimdal always
-     * defines krb5_boolean to int or this will require more portability work.
-     */
-    realm = default_realm(ctx);
-    krb5_appdefault_boolean(ctx, "krb5-strength", realm, opt, *result, &tmp);
-    *result = tmp;
-    free_default_realm(ctx, realm);
+    value = config_value(ctx, config, opt);
+    if (value == NULL)
+        return;
+    for (i = 0; i < ARRAY_SIZE(yes); i++)
+        if (strcasecmp(value, yes[i]) == 0) {
+            *result = true;
+            return;
+        }
+    for (i = 0; i < ARRAY_SIZE(no); i++)
+        if (strcasecmp(value, no[i]) == 0) {
+            *result = false;
+            return;
+        }
+    errno = 0;
+    number = strtol(value, &end, 10);
+    if (errno == 0 && *end == '\0')
+        *result = (number != 0);
 }
 
 
@@ -243,13 +410,13 @@ fail:
 
 
 /*
- * Parse character class requirements from Kerberos appdefaults.  Takes the
- * Kerberos context, the option, and the place to store the linked list of
- * class requirements.
+ * Parse character class requirements from the configuration snapshot.  Takes
+ * the Kerberos context, the snapshot, the option, and the place to store the
+ * linked list of class requirements.
  */
 krb5_error_code
-strength_config_classes(krb5_context ctx, const char *opt,
-                        struct class_rule **result)
+strength_config_classes(krb5_context ctx, struct strength_config *snapshot,
+                        const char *opt, struct class_rule **result)
 {
     struct vector *config = NULL;
     struct class_rule *rules, *last, *tmp;
@@ -257,7 +424,7 @@ strength_config_classes(krb5_context ctx, const char *opt,
     size_t i;
 
     /* Get the basic configuration as a list. */
-    code = strength_config_list(ctx, opt, &config);
+    code = strength_config_list(ctx, snapshot, opt, &config);
     if (code != 0)
         return code;
     if (config == NULL || config->count == 0) {
@@ -295,99 +462,69 @@ fail:
 
 
 /*
- * Load a list option from Kerberos appdefaults.  Takes the Kerberos context,
- * the option, and the result location.  The option is read as a string and
- * the split on spaces and tabs into a list.
- *
- * This requires an annoying workaround because one cannot specify a default
- * value of NULL with MIT Kerberos, since MIT Kerberos unconditionally calls
- * strdup on the default value.  There's also no way to determine if memory
- * allocation failed while parsing or while setting the default value.
+ * Load a list option from the configuration snapshot.  Takes the Kerberos
+ * context, the snapshot, the option, and the result location.  The option is
+ * read as a string and the split on spaces and tabs into a list.
  */
 krb5_error_code
-strength_config_list(krb5_context ctx, const char *opt, struct vector **result)
+strength_config_list(krb5_context ctx, struct strength_config *config,
+                     const char *opt, struct vector **result)
 {
-    realm_type realm;
-    char *value = NULL;
-
-    /* Obtain the string from [appdefaults]. */
-    realm = default_realm(ctx);
-    krb5_appdefault_string(ctx, "krb5-strength", realm, opt, "", &value);
-    free_default_realm(ctx, realm);
+    const char *value;
 
-    /* If we got something back, store it in result. */
+    value = config_value(ctx, config, opt);
     if (value != NULL) {
-        if (value[0] != '\0') {
-            *result = strength_vector_split_multi(value, " \t", *result);
-            if (*result == NULL)
-                return strength_error_system(ctx, "cannot allocate memory");
-        }
-        krb5_free_string(ctx, value);
+        *result = strength_vector_split_multi(value, " \t", *result);
+        if (*result == NULL)
+            return strength_error_system(ctx, "cannot allocate memory");
     }
     return 0;
 }
 
 
 /*
- * Load a number option from Kerberos appdefaults.  Takes the Kerberos
- * context, the option, and the result location.  The native interface doesn't
- * support numbers, so we actually read a string and then convert.
+ * Load a number option from the configuration snapshot.  Takes the Kerberos
+ * context, the snapshot, the option, and the result location.  The native
+ * interface doesn't support numbers, so we actually read a string and then
+ * convert.
  */
 void
-strength_config_number(krb5_context ctx, const char *opt, long *result)
+strength_config_number(krb5_context ctx, struct strength_config *config,
+                       const char *opt, long *result)
 {
-    realm_type realm;
-    char *tmp = NULL;
+    const char *value;
     char *end;
-    long value;
-
-    /* Obtain the setting in string form from [appdefaults]. */
-    realm = default_realm(ctx);
-    krb5_appdefault_string(ctx, "krb5-strength", realm, opt, "", &tmp);
-    free_default_realm(ctx, realm);
+    long number;
 
     /*
      * If we found anything, convert it to a number.  Currently, we ignore
      * errors here.
      */
-    if (tmp != NULL && tmp[0] != '\0') {
+    value = config_value(ctx, config, opt);
+    if (value != NULL) {
         errno = 0;
-        value = strtol(tmp, &end, 10);
+        number = strtol(value, &end, 10);
         if (errno == 0 && *end == '\0')
-            *result = value;
+            *result = number;
     }
-    if (tmp != NULL)
-        krb5_free_string(ctx, tmp);
 }
 
 
 /*
- * Load a string option from Kerberos appdefaults.  Takes the Kerberos
- * context, the option, and the result location.
- *
- * This requires an annoying workaround because one cannot specify a default
- * value of NULL with MIT Kerberos, since MIT Kerberos unconditionally calls
- * strdup on the default value.  There's also no way to determine if memory
- * allocation failed while parsing or while setting the default value, so we
- * don't return an error code.
+ * Load a string option from the configuration snapshot.  Takes the Kerberos
+ * context, the snapshot, the option, and the result location.  There's no way
+ * to report memory allocation failures in the underlying Kerberos functions,
+ * so we don't return an error code.
  */
 void
-strength_config_string(krb5_context ctx, const char *opt, char **result)
+strength_config_string(krb5_context ctx, struct strength_config *config,
+                       const char *opt, char **result)
 {
-    realm_type realm;
-    char *value = NULL;
+    const char *value;
 
-    /* Obtain the string from [appdefaults]. */
-    realm = default_realm(ctx);
-    krb5_appdefault_string(ctx, "krb5-strength", realm, opt, "", &value);
-    free_default_realm(ctx, realm);
-
-    /* If we got something back, store it in result. */
+    value = config_value(ctx, config, opt);
     if (value != NULL) {
-        if (value[0] != '\0') {
-            free(*result);
-            *result = strdup(value);
-        }
-        krb5_free_string(ctx, value);
+        free(*result);
+        *result = strdup(value);
     }
 }
@@ -21,9 +21,15 @@
 #include <plugin/internal.h>
 #include <util/macros.h>
 
-/* When using the embedded CrackLib, we need to provide our own prototype. */
+/*
+ * The embedded CrackLib declares FascistCheck and FindPWProbes, the count of
+ * dictionary words compared, in its own header.  Otherwise, we may need to
+ * provide our own prototype.
+ */
 #ifdef HAVE_CRACKLIB
-#    ifdef HAVE_CRACK_H
+#    ifndef HAVE_SYSTEM_CRACKLIB
+#        include <cracklib/packer.h>
+#    elif defined(HAVE_CRACK_H)
 #        include <crack.h>
 #    else
 extern const char *FascistCheck(const char *password, const char *dict);
@@ -36,13 +42,13 @@ extern const char *FascistCheck(const char *password, const char *dict);
  */
 #ifndef HAVE_CRACKLIB
 krb5_error_code
-strength_init_cracklib(krb5_context ctx, krb5_pwqual_moddata data UNUSED,
+strength_init_cracklib(krb5_context ctx, krb5_pwqual_moddata data,
                        const char *dictionary UNUSED)
 {
     char *path = NULL;
 
     /* Get CDB dictionary path from krb5.conf. */
-    strength_config_string(ctx, "password_dictionary", &path);
+    strength_config_string(ctx, data->config, "password_dictionary", &path);
 
     /* If it was set, report an error, since we don't have CrackLib support. */
     if (path == NULL)
@@ -82,7 +88,8 @@ strength_init_cracklib(krb5_context ctx, krb5_pwqual_moddata data,
      * other password strength modules while using a different dictionary for
      * krb5-strength.
      */
-    strength_config_string(ctx, "password_dictionary", &data->dictionary);
+    strength_config_string(ctx, data->config, "password_dictionary",
+                           &data->dictionary);
     if (data->dictionary == NULL && dictionary != NULL) {
         data->dictionary = strdup(dictionary);
         if (data->dictionary == NULL)
@@ -115,22 +122,36 @@ strength_check_cracklib(krb5_context ctx, krb5_pwqual_moddata data,
                         const char *password)
 {
     const char *result;
+    krb5_error_code code = 0;
+    size_t length;
 
     /* Nothing to do if we don't have a dictionary. */
+    data->cracklib_probes = 0;
     if (data->dictionary == NULL)
         return 0;
 
     /* Nothing to do if the password is longer than the maximum length. */
+    length = strlen(password);
     if (data->cracklib_maxlen > 0)
-        if (strlen(password) > (size_t) data->cracklib_maxlen)
+        if (length > (size_t) data->cracklib_maxlen)
             return 0;
 
-    /* Check the password against CrackLib and return the results. */
+    /*
+     * Check the password against CrackLib and return the results.  The
+     * embedded CrackLib also counts the dictionary words it compared.
+     */
+    STRENGTH_PROBE1(cracklib_entry, length);
+#    ifndef HAVE_SYSTEM_CRACKLIB
+    data->cracklib_probes = FindPWProbes;
+#    endif
     result = FascistCheck(password, data->dictionary);
+#    ifndef HAVE_SYSTEM_CRACKLIB
+    data->cracklib_probes = FindPWProbes - data->cracklib_probes;
+#    endif
     if (result != NULL)
-        return strength_error_generic(ctx, "%s", result);
-    else
-        return 0;
+        code = strength_error_generic(ctx, "%s", result);
+    STRENGTH_PROBE1(cracklib_return, code);
+    return code;
 }
 
 #endif /* HAVE_CRACKLIB */
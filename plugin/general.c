@@ -18,66 +18,459 @@
 #include <portable/krb5.h>
 #include <portable/system.h>
 
-#include <ctype.h>
-
 #include <plugin/internal.h>
 #include <util/macros.h>
 
 
+/* Indices of the checks in the stages table below. */
+enum stage_index {
+    STAGE_LENGTH,
+    STAGE_ASCII,
+    STAGE_LETTER,
+    STAGE_DIFFERENT,
+    STAGE_CLASSES,
+    STAGE_PRINCIPAL,
+    STAGE_CDB,
+    STAGE_SQLITE,
+    STAGE_CRACKLIB
+};
+
+
+/*
+ * Reject passwords that are too short.
+ */
+static krb5_error_code
+stage_length(krb5_context ctx, krb5_pwqual_moddata data,
+             const char *principal UNUSED, const char *password UNUSED,
+             const struct password_info *info)
+{
+    if ((long) info->length < data->minimum_length)
+        return strength_error_tooshort(ctx, ERROR_SHORT);
+    return 0;
+}
+
+
+/*
+ * Reject passwords that contain non-ASCII or non-printable ASCII characters.
+ */
+static krb5_error_code
+stage_ascii(krb5_context ctx, krb5_pwqual_moddata data UNUSED,
+            const char *principal UNUSED, const char *password UNUSED,
+            const struct password_info *info)
+{
+    if (!info->printable)
+        return strength_error_generic(ctx, ERROR_ASCII);
+    return 0;
+}
+
+
+/*
+ * Reject passwords that contain only letters and spaces.  This requires that
+ * people using phrases at least include a digit or punctuation to make
+ * phrase dictionary attacks or dictionary attacks via combinations of words
+ * harder.
+ */
+static krb5_error_code
+stage_letter(krb5_context ctx, krb5_pwqual_moddata data UNUSED,
+             const char *principal UNUSED, const char *password UNUSED,
+             const struct password_info *info)
+{
+    if (info->alpha_space)
+        return strength_error_class(ctx, ERROR_LETTER);
+    return 0;
+}
+
+
+/*
+ * Reject passwords without enough unique characters.
+ */
+static krb5_error_code
+stage_different(krb5_context ctx, krb5_pwqual_moddata data,
+                const char *principal UNUSED, const char *password UNUSED,
+                const struct password_info *info)
+{
+    if ((long) info->unique < data->minimum_different)
+        return strength_error_class(ctx, ERROR_MINDIFF);
+    return 0;
+}
+
+
+/*
+ * Reject passwords that don't satisfy character class restrictions.
+ */
+static krb5_error_code
+stage_classes(krb5_context ctx, krb5_pwqual_moddata data,
+              const char *principal UNUSED, const char *password UNUSED,
+              const struct password_info *info)
+{
+    return strength_check_classes(ctx, data, info);
+}
+
+
+/*
+ * Reject passwords based on the principal in some way.
+ */
+static krb5_error_code
+stage_principal(krb5_context ctx, krb5_pwqual_moddata data,
+                const char *principal, const char *password,
+                const struct password_info *info UNUSED)
+{
+    return strength_check_principal(ctx, data, principal, password);
+}
+
+
+/*
+ * Reject passwords found in the CDB, SQLite, or CrackLib dictionaries.  The
+ * data argument is only used if built with support for that dictionary.
+ */
+static krb5_error_code
+stage_cdb(krb5_context ctx UNUSED, krb5_pwqual_moddata data UNUSED,
+          const char *principal UNUSED, const char *password UNUSED,
+          const struct password_info *info UNUSED)
+{
+    return strength_check_cdb(ctx, data, password);
+}
+
+static krb5_error_code
+stage_sqlite(krb5_context ctx UNUSED, krb5_pwqual_moddata data UNUSED,
+             const char *principal UNUSED, const char *password UNUSED,
+             const struct password_info *info UNUSED)
+{
+    return strength_check_sqlite(ctx, data, password);
+}
+
+static krb5_error_code
+stage_cracklib(krb5_context ctx UNUSED, krb5_pwqual_moddata data UNUSED,
+               const char *principal UNUSED, const char *password UNUSED,
+               const struct password_info *info UNUSED)
+{
+    return strength_check_cracklib(ctx, data, password);
+}
+
+
+/*
+ * All of the checks, indexed by enum stage_index and listed in the default
+ * order, which is roughly from cheapest to most expensive so that the
+ * dictionary checks are only done for passwords that pass all of the simple
+ * checks.  Each has the name used in the check_order setting and whether it
+ * uses the summary from strength_analyze.
+ */
+static const struct {
+    const char *name;
+    strength_stage check;
+    bool analyze;
+} stages[] = {
+    /* clang-format off */
+    {"length",    stage_length,    true},
+    {"ascii",     stage_ascii,     true},
+    {"letter",    stage_letter,    true},
+    {"different", stage_different, true},
+    {"classes",   stage_classes,   true},
+    {"principal", stage_principal, false},
+    {"cdb",       stage_cdb,       false},
+    {"sqlite",    stage_sqlite,    false},
+    {"cracklib",  stage_cracklib,  false},
+    /* clang-format on */
+};
+
+
+/*
+ * Add a check to the plan if it is enabled and not already present.
+ */
+static void
+plan_add(krb5_pwqual_moddata data, size_t stage, const bool *enabled,
+         bool *added)
+{
+    if (!enabled[stage] || added[stage])
+        return;
+    data->plan_ids[data->plan_length] = (unsigned int) stage;
+    data->plan[data->plan_length++] = stages[stage].check;
+    if (stages[stage].analyze)
+        data->plan_analyze = true;
+    added[stage] = true;
+}
+
+
+/*
+ * Build the plan for checking passwords from the configuration, which must
+ * already have been loaded into the module data.  The plan contains only the
+ * enabled checks.  Checks named in the check_order setting are run first in
+ * the order given, followed by any other enabled checks in the default
+ * order.  Returns 0 on success or a Kerberos error code on failure.
+ */
+static krb5_error_code
+compile_plan(krb5_context ctx, krb5_pwqual_moddata data)
+{
+    bool enabled[ARRAY_SIZE(stages)] = {false};
+    bool added[ARRAY_SIZE(stages)] = {false};
+    struct vector *order = NULL;
+    krb5_error_code code;
+    size_t i, stage;
+
+    /* Determine which checks are enabled. */
+    enabled[STAGE_LENGTH] = (data->minimum_length > 0);
+    enabled[STAGE_ASCII] = data->ascii;
+    enabled[STAGE_LETTER] = data->nonletter;
+    enabled[STAGE_DIFFERENT] = (data->minimum_different > 0);
+    enabled[STAGE_CLASSES] = (data->rules != NULL);
+    enabled[STAGE_PRINCIPAL] = true;
+    enabled[STAGE_CDB] = (data->cdb_path != NULL);
+#ifdef HAVE_SQLITE3
+    enabled[STAGE_SQLITE] = (data->sqlite_path != NULL);
+#endif
+    enabled[STAGE_CRACKLIB] = (data->dictionary != NULL);
+
+    /* Add any checks named in check_order. */
+    code = strength_config_list(ctx, data->config, "check_order", &order);
+    if (code != 0)
+        return code;
+    for (i = 0; order != NULL && i < order->count; i++) {
+        for (stage = 0; stage < ARRAY_SIZE(stages); stage++)
+            if (strcmp(order->strings[i], stages[stage].name) == 0)
+                break;
+        if (stage == ARRAY_SIZE(stages)) {
+            code = strength_error_config(ctx, "unknown check %s in"
+                                         " check_order", order->strings[i]);
+            strength_vector_free(order);
+            return code;
+        }
+        plan_add(data, stage, enabled, added);
+    }
+    strength_vector_free(order);
+
+    /* Add the remaining enabled checks in the default order. */
+    for (stage = 0; stage < ARRAY_SIZE(stages); stage++)
+        plan_add(data, stage, enabled, added);
+    return 0;
+}
+
+
+/*
+ * Append to a string being built in a fixed-size buffer, keeping track of how
+ * much has been used.  Output that doesn't fit is silently truncated.
+ */
+static void __attribute__((__format__(printf, 4, 5)))
+append(char *buffer, size_t size, size_t *used, const char *format, ...)
+{
+    va_list args;
+    int status;
+
+    if (*used >= size)
+        return;
+    va_start(args, format);
+    status = vsnprintf(buffer + *used, size - *used, format, args);
+    va_end(args);
+    if (status > 0)
+        *used += (size_t) status;
+}
+
+
+/*
+ * Return the time in microseconds since the timestamp in mark and reset mark
+ * to now, for timing each step of initialization.
+ */
+static uint64_t
+lap(uint64_t *mark)
+{
+    uint64_t now, elapsed;
+
+    now = strength_timestamp();
+    elapsed = now - *mark;
+    *mark = now;
+    return elapsed;
+}
+
+
 /*
- * Initialize the module.  Ensure that the dictionary file exists and is
- * readable and store the path in the module context.  Returns 0 on success,
- * non-zero on failure.  This function returns failure only if it could not
- * allocate memory or internal Kerberos calls that shouldn't fail do.
+ * Log how long initializing the module data took in total and for each type
+ * of dictionary, in the order that strength_init_section sets them up.  Used
+ * if debug_init_timing is set.
+ */
+static void
+log_init_time(krb5_pwqual_moddata data, const uint64_t *times,
+              uint64_t elapsed)
+{
+    static const char *const names[] = {"cracklib", "cdb", "sqlite",
+                                        "languages"};
+    char breakdown[256];
+    size_t i, used = 0;
+
+    breakdown[0] = '\0';
+    for (i = 0; i < ARRAY_SIZE(names); i++)
+        append(breakdown, sizeof(breakdown), &used, "%s%s %lu.%03lu ms",
+               (i == 0) ? "" : ", ", names[i],
+               (unsigned long) (times[i] / 1000),
+               (unsigned long) (times[i] % 1000));
+    strength_log_info("initialized %s%s in %lu.%03lu ms%s: %s",
+                      (data->section == NULL) ? "default settings"
+                                              : "settings for ",
+                      (data->section == NULL) ? "" : data->section,
+                      (unsigned long) (elapsed / 1000),
+                      (unsigned long) (elapsed % 1000),
+                      data->lazy ? " with lazy dictionaries" : "", breakdown);
+}
+
+
+/*
+ * If stats_file is set, map the shared statistics file, creating it if
+ * needed.  Returns 0 on success or a Kerberos error code on failure.
+ */
+static krb5_error_code
+init_stats(krb5_context ctx, krb5_pwqual_moddata data)
+{
+    const char *names[ARRAY_SIZE(stages)];
+    krb5_error_code code;
+    char *path = NULL;
+    size_t i;
+
+    strength_config_string(ctx, data->config, "stats_file", &path);
+    if (path == NULL)
+        return 0;
+    for (i = 0; i < ARRAY_SIZE(stages); i++)
+        names[i] = stages[i].name;
+    data->stats = strength_stats_open(path, names, true);
+    if (data->stats == NULL) {
+        code = strength_error_system(ctx, "cannot open statistics file %s",
+                                     path);
+        free(path);
+        return code;
+    }
+    free(path);
+    return 0;
+}
+
+
+/*
+ * Initialize a policy from a subsection of the settings named after a realm
+ * or kadmin policy, using the settings for the default realm if section is
+ * NULL.  Ensure that the dictionary file exists and is readable and store the
+ * path in the module context.  Returns 0 on success, non-zero on failure.
+ * This function returns failure only if it could not allocate memory or
+ * internal Kerberos calls that shouldn't fail do.
+ *
+ * The module data for the default realm also holds the other policies, so
+ * save the dictionary for them and build the policies for kadmin policies.
  *
  * The dictionary file should not include the trailing .pwd extension.
  * Currently, we don't cope with a NULL dictionary path.
  */
 krb5_error_code
-strength_init(krb5_context ctx, const char *dictionary,
-              krb5_pwqual_moddata *moddata)
+strength_init_section(krb5_context ctx, const char *dictionary,
+                      const char *section, krb5_pwqual_moddata *moddata)
 {
     krb5_pwqual_moddata data = NULL;
     krb5_error_code code;
+    const char *name;
+    bool debug_timing = false;
+    uint64_t start, mark, times[4];
 
     /* Allocate our internal data. */
+    start = strength_timestamp();
     data = calloc(1, sizeof(*data));
     if (data == NULL)
         return strength_error_system(ctx, "cannot allocate memory");
     data->cdb_fd = -1;
 
+    /* Take a snapshot of the configuration used for the rest of setup. */
+    code = strength_config_open(ctx, section, &data->config);
+    if (code != 0)
+        goto fail;
+    name = strength_config_section(data->config);
+    if (name != NULL) {
+        data->section = strdup(name);
+        if (data->section == NULL) {
+            code = strength_error_system(ctx, "cannot allocate memory");
+            goto fail;
+        }
+    }
+
+    /* Get whether to defer opening dictionaries and report timing. */
+    strength_config_boolean(ctx, data->config, "lazy_dictionaries",
+                            &data->lazy);
+    strength_config_boolean(ctx, data->config, "debug_init_timing",
+                            &debug_timing);
+
     /* Get minimum length and character information from krb5.conf. */
-    strength_config_number(ctx, "minimum_different", &data->minimum_different);
-    strength_config_number(ctx, "minimum_length", &data->minimum_length);
+    strength_config_number(ctx, data->config, "minimum_different",
+                           &data->minimum_different);
+    strength_config_number(ctx, data->config, "minimum_length",
+                           &data->minimum_length);
 
     /* Get simple character class restrictions from krb5.conf. */
-    strength_config_boolean(ctx, "require_ascii_printable", &data->ascii);
-    strength_config_boolean(ctx, "require_non_letter", &data->nonletter);
+    strength_config_boolean(ctx, data->config, "require_ascii_printable",
+                            &data->ascii);
+    strength_config_boolean(ctx, data->config, "require_non_letter",
+                            &data->nonletter);
 
     /* Get complex character class restrictions from krb5.conf. */
-    code = strength_config_classes(ctx, "require_classes", &data->rules);
+    code = strength_init_classes(ctx, data);
     if (code != 0)
         goto fail;
 
     /* Get CrackLib maximum length from krb5.conf. */
-    strength_config_number(ctx, "cracklib_maxlen", &data->cracklib_maxlen);
+    strength_config_number(ctx, data->config, "cracklib_maxlen",
+                           &data->cracklib_maxlen);
 
     /*
      * Try to initialize CDB, CrackLib, and SQLite dictionaries.  These
      * functions handle their own configuration parsing and will do nothing if
-     * the corresponding dictionary is not configured.
+     * the corresponding dictionary is not configured.  Time each of them for
+     * debug_init_timing.
      */
+    mark = strength_timestamp();
     code = strength_init_cracklib(ctx, data, dictionary);
     if (code != 0)
         goto fail;
+    times[0] = lap(&mark);
     code = strength_init_cdb(ctx, data);
     if (code != 0)
         goto fail;
+    times[1] = lap(&mark);
     code = strength_init_sqlite(ctx, data);
+    if (code != 0)
+        goto fail;
+    times[2] = lap(&mark);
+    code = strength_init_languages(ctx, data);
+    if (code != 0)
+        goto fail;
+    times[3] = lap(&mark);
+
+    /* Build the plan of enabled checks. */
+    code = compile_plan(ctx, data);
     if (code != 0)
         goto fail;
 
-    /* Initialized.  Set moddata and return. */
+    /* Set up shared statistics and logging of slow checks if configured. */
+    code = init_stats(ctx, data);
+    if (code != 0)
+        goto fail;
+    strength_config_number(ctx, data->config, "slow_check_threshold_ms",
+                           &data->slow_check_threshold);
+
+    /* Get how often a long-running plugin looks for configuration changes. */
+    data->reload_interval = -1;
+    strength_config_number(ctx, data->config, "reload_interval",
+                           &data->reload_interval);
+
+    /* Build the policies for kadmin policies if this is the default realm. */
+    if (section == NULL) {
+        if (dictionary != NULL) {
+            data->init_dictionary = strdup(dictionary);
+            if (data->init_dictionary == NULL) {
+                code = strength_error_system(ctx, "cannot allocate memory");
+                goto fail;
+            }
+        }
+        code = strength_policy_init(ctx, data);
+        if (code != 0)
+            goto fail;
+    }
+
+    /* Initialized.  Discard the configuration, set moddata, and return. */
+    strength_config_close(ctx, data->config);
+    data->config = NULL;
+    if (debug_timing)
+        log_init_time(data, times, strength_timestamp() - start);
     *moddata = data;
     return 0;
 
@@ -90,130 +483,224 @@ fail:
 
 
 /*
- * Check if a password contains only printable ASCII characters.
+ * Initialize the module with the policy for the default realm.
  */
-static bool
-only_printable_ascii(const char *password)
+krb5_error_code
+strength_init(krb5_context ctx, const char *dictionary,
+              krb5_pwqual_moddata *moddata)
 {
-    const char *p;
-
-    for (p = password; *p != '\0'; p++)
-        if (!isascii((unsigned char) *p) || !isprint((unsigned char) *p))
-            return false;
-    return true;
+    return strength_init_section(ctx, dictionary, NULL, moddata);
 }
 
 
 /*
- * Check if a password contains only letters and spaces.
+ * Run each check in the plan built by strength_init and stop at the first
+ * failure.  If any check needs it, the password is first summarized in a
+ * single pass.
  */
-static bool
-only_alpha_space(const char *password)
+static krb5_error_code
+check_plan(krb5_context ctx, krb5_pwqual_moddata data, const char *principal,
+           const char *password)
 {
-    const char *p;
+    krb5_error_code code;
+    struct password_info info;
+    size_t i;
+
+    if (data->plan_analyze)
+        strength_analyze(password, &info);
+    for (i = 0; i < data->plan_length; i++) {
+        STRENGTH_PROBE1(stage_entry, data->plan_ids[i]);
+        code = data->plan[i](ctx, data, principal, password, &info);
+        STRENGTH_PROBE2(stage_return, data->plan_ids[i], code);
+        if (code != 0)
+            return code;
+    }
 
-    for (p = password; *p != '\0'; p++)
-        if (!isalpha((unsigned char) *p) && *p != ' ')
-            return false;
-    return true;
+    /* Success.  Password accepted. */
+    return 0;
 }
 
 
 /*
- * Check if a password has a sufficient number of unique characters.  Takes
- * the password and the required number of characters.
+ * Log a password check that took longer than slow_check_threshold, with the
+ * time taken by each check that was run and the work done by the dictionary
+ * checks.  times holds the time in microseconds of the first count checks in
+ * the plan.  Nothing about the password or principal is logged.
  */
-static bool
-has_minimum_different(const char *password, long minimum)
+static void
+log_slow_check(krb5_pwqual_moddata data, const uint64_t *times, size_t count,
+               uint64_t elapsed, bool rejected)
 {
-    size_t unique;
-    const char *p;
+    char breakdown[512];
+    size_t i, used = 0;
+    unsigned int stage;
+
+    breakdown[0] = '\0';
+    for (i = 0; i < count; i++) {
+        stage = data->plan_ids[i];
+        append(breakdown, sizeof(breakdown), &used, "%s%s %lu.%03lu ms",
+               (i == 0) ? "" : ", ", stages[stage].name,
+               (unsigned long) (times[i] / 1000),
+               (unsigned long) (times[i] % 1000));
+        if (stage == STAGE_CDB)
+            append(breakdown, sizeof(breakdown), &used, " (%lu lookups)",
+                   data->cdb_lookups);
+        else if (stage == STAGE_SQLITE)
+            append(breakdown, sizeof(breakdown), &used, " (%lu rows)",
+                   data->sqlite_rows);
+#ifndef HAVE_SYSTEM_CRACKLIB
+        else if (stage == STAGE_CRACKLIB)
+            append(breakdown, sizeof(breakdown), &used, " (%lu probes)",
+                   data->cracklib_probes);
+#endif
+    }
+    strength_log_info("slow password check %s in %lu.%03lu ms: %s",
+                      rejected ? "rejected" : "accepted",
+                      (unsigned long) (elapsed / 1000),
+                      (unsigned long) (elapsed % 1000), breakdown);
+}
 
-    /* Special cases for passwords of length 0 and a minimum <= 1. */
-    if (password == NULL || password[0] == '\0')
-        return minimum <= 0;
-    if (minimum <= 1)
-        return true;
 
-    /*
-     * Count the number of unique characters by incrementing the count if each
-     * subsequent character is not found in the previous password characters.
-     * This algorithm is O(n^2), but passwords are short enough it shouldn't
-     * matter.
-     */
-    unique = 1;
-    for (p = password + 1; *p != '\0'; p++)
-        if (memchr(password, *p, p - password) == NULL) {
-            unique++;
-            if (unique >= (size_t) minimum)
-                return true;
-        }
-    return false;
+/*
+ * The same as check_plan, but also times each check and the whole call.  The
+ * times are recorded in the shared statistics if those are configured, and
+ * the call is logged with a breakdown by check if it took longer than
+ * slow_check_threshold.
+ */
+static krb5_error_code
+check_timed(krb5_context ctx, krb5_pwqual_moddata data, const char *principal,
+            const char *password)
+{
+    struct strength_stats *stats = data->stats;
+    krb5_error_code code = 0;
+    struct password_info info;
+    uint64_t times[STRENGTH_MAX_STAGES];
+    uint64_t start, stage_start, elapsed;
+    size_t i;
+
+    start = strength_timestamp();
+    if (data->plan_analyze)
+        strength_analyze(password, &info);
+    for (i = 0; i < data->plan_length && code == 0; i++) {
+        STRENGTH_PROBE1(stage_entry, data->plan_ids[i]);
+        stage_start = strength_timestamp();
+        code = data->plan[i](ctx, data, principal, password, &info);
+        times[i] = strength_timestamp() - stage_start;
+        STRENGTH_PROBE2(stage_return, data->plan_ids[i], code);
+        if (stats != NULL)
+            strength_stats_record(&stats->stage[data->plan_ids[i]], code != 0,
+                                  times[i]);
+    }
+    elapsed = strength_timestamp() - start;
+    if (stats != NULL)
+        strength_stats_record(&stats->total, code != 0, elapsed);
+    if (data->slow_check_threshold > 0
+        && elapsed > (uint64_t) data->slow_check_threshold * 1000)
+        log_slow_check(data, times, i, elapsed, code != 0);
+    return code;
 }
 
 
 /*
  * Check a given password.  Takes a Kerberos context, our module data, the
- * password, the principal the password is for, and a buffer and buffer length
- * into which to put any failure message.
+ * name of the kadmin password policy of the principal or NULL, the principal
+ * the password is for, the password, and the languages of the user or NULL.
+ * The password is checked against the policy for that kadmin policy if there
+ * is one and otherwise against the policy for the realm of the principal, and
+ * then against the dictionaries for the languages of the user.
+ *
+ * Other than in CrackLib, the first time a realm is seen, or the first time
+ * a lazily opened dictionary is used, accepting a password does not allocate
+ * memory; tests/plugin/alloc-t verifies this.  If shared statistics or
+ * logging of slow checks are configured, the checks are timed as they run.
+ * The check_entry and check_return tracepoints bracket the whole call.
  */
 krb5_error_code
-strength_check(krb5_context ctx UNUSED, krb5_pwqual_moddata data,
-               const char *principal, const char *password)
+strength_check_policy(krb5_context ctx, krb5_pwqual_moddata data,
+                      const char *policy, const char *principal,
+                      const char *password, const char **languages)
 {
     krb5_error_code code;
 
-    /* Check minimum length first, since that's easy. */
-    if ((long) strlen(password) < data->minimum_length)
-        return strength_error_tooshort(ctx, ERROR_SHORT);
+    code = strength_policy_select(ctx, data, policy, principal, &data);
+    if (code != 0)
+        return code;
+    STRENGTH_PROBE1(check_entry, data->plan_length);
+    if (data->stats != NULL || data->slow_check_threshold > 0)
+        code = check_timed(ctx, data, principal, password);
+    else
+        code = check_plan(ctx, data, principal, password);
+    if (code == 0 && data->languages_count > 0)
+        code = strength_check_languages(ctx, data, languages, password);
+    STRENGTH_PROBE1(check_return, code);
+    return code;
+}
 
-    /*
-     * If desired, check whether the password contains non-ASCII or
-     * non-printable ASCII characters.
-     */
-    if (data->ascii && !only_printable_ascii(password))
-        return strength_error_generic(ctx, ERROR_ASCII);
 
-    /*
-     * If desired, ensure the password has a non-letter (and non-space)
-     * character.  This requires that people using phrases at least include a
-     * digit or punctuation to make phrase dictionary attacks or dictionary
-     * attacks via combinations of words harder.
-     */
-    if (data->nonletter && only_alpha_space(password))
-        return strength_error_class(ctx, ERROR_LETTER);
+/*
+ * Check a given password for a principal with no known kadmin policy.
+ */
+krb5_error_code
+strength_check(krb5_context ctx, krb5_pwqual_moddata data,
+               const char *principal, const char *password)
+{
+    return strength_check_policy(ctx, data, NULL, principal, password, NULL);
+}
 
-    /* If desired, check for enough unique characters. */
-    if (data->minimum_different > 0)
-        if (!has_minimum_different(password, data->minimum_different))
-            return strength_error_class(ctx, ERROR_MINDIFF);
 
-    /*
-     * If desired, check that the password satisfies character class
-     * restrictions.
-     */
-    code = strength_check_classes(ctx, data, password);
-    if (code != 0)
-        return code;
+/*
+ * Check a given password against every check in the plan, sharing the summary
+ * of the password between them, and record every check that rejects it.
+ * This is used for auditing existing passwords against a policy, where it's
+ * useful to know everything that's wrong with a password.  Each failing check
+ * overwrites the error message in the Kerberos context, so save the first one
+ * and restore it at the end.
+ */
+krb5_error_code
+strength_check_all(krb5_context ctx, krb5_pwqual_moddata data,
+                   const char *principal, const char *password,
+                   unsigned long *failures)
+{
+    krb5_error_code code;
+    krb5_error_code first = 0;
+    const char *message = NULL;
+    struct password_info info;
+    size_t i;
 
-    /* Check if the password is based on the principal in some way. */
-    code = strength_check_principal(ctx, data, principal, password);
+    *failures = 0;
+    code = strength_policy_select(ctx, data, NULL, principal, &data);
     if (code != 0)
         return code;
+    if (data->plan_analyze)
+        strength_analyze(password, &info);
+    for (i = 0; i < data->plan_length; i++) {
+        code = data->plan[i](ctx, data, principal, password, &info);
+        if (code == 0)
+            continue;
+        *failures |= 1UL << data->plan_ids[i];
+        if (first == 0) {
+            first = code;
+            message = krb5_get_error_message(ctx, code);
+        }
+    }
+    if (message != NULL) {
+        krb5_set_error_message(ctx, first, "%s", message);
+        krb5_free_error_message(ctx, message);
+    }
+    return first;
+}
 
-    /* Check the password against CDB, CrackLib, and SQLite if configured. */
-    code = strength_check_cracklib(ctx, data, password);
-    if (code != 0)
-        return code;
-    code = strength_check_cdb(ctx, data, password);
-    if (code != 0)
-        return code;
-    code = strength_check_sqlite(ctx, data, password);
-    if (code != 0)
-        return code;
 
-    /* Success.  Password accepted. */
-    return 0;
+/*
+ * Return the name of a check given its index, as used in the mask returned by
+ * strength_check_all, or NULL if there is no check with that index.
+ */
+const char *
+strength_check_name(size_t check)
+{
+    if (check >= ARRAY_SIZE(stages))
+        return NULL;
+    return stages[check].name;
 }
 
 
@@ -230,12 +717,20 @@ strength_close(krb5_context ctx UNUSED, krb5_pwqual_moddata data)
         return;
     strength_close_cdb(ctx, data);
     strength_close_sqlite(ctx, data);
+    strength_close_languages(ctx, data);
     last = data->rules;
     while (last != NULL) {
         tmp = last;
         last = last->next;
         free(tmp);
     }
+    strength_stats_close(data->stats);
+    strength_policy_free(ctx, data);
+    strength_watch_free(data);
+    strength_config_close(ctx, data->config);
+    free(data->class_table);
     free(data->dictionary);
+    free(data->init_dictionary);
+    free(data->section);
     free(data);
 }
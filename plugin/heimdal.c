@@ -4,15 +4,15 @@
  * This is the glue required for a Heimdal password quality check via a
  * dynamically loaded module.  Heimdal's shared module API doesn't have
  * separate initialization and shutdown functions, so provide a self-contained
- * function that looks up the dictionary path from krb5.conf and does all the
- * work.  This means that it does memory allocations on every call, which
- * isn't ideal, but it's probably not that slow.
+ * function that initializes the checks on first use and keeps the module data
+ * for later calls, initializing it again only if the Kerberos context,
+ * krb5.conf, or one of the dictionaries changes.
  *
  * Of course, the external Heimdal strength checking program can be used
  * instead.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
- * Copyright 2020, 2023 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2020, 2023, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2009, 2013
  *     The Board of Trustees of the Leland Stanford Junior University
  *
@@ -54,10 +54,69 @@ convert_error(krb5_context ctx, krb5_error_code code, const char *prefix,
 }
 
 
+/*
+ * The module data kept between calls and the Kerberos context with which it
+ * was created.  The context is only compared with the context passed to later
+ * calls, never used, since it may have been freed.  Heimdal's kadmind and
+ * kpasswdd check passwords in a single thread, so there is no locking.
+ */
+static krb5_context cached_ctx = NULL;
+static krb5_pwqual_moddata cached_data = NULL;
+
+
+/*
+ * Get the module data to use for a check with the given context, reusing the
+ * module data from the previous call if it was created with the same context
+ * and neither krb5.conf nor any of the dictionaries has changed since.
+ * Otherwise, initialize new module data and remember it for the next call.
+ * Since a new context may be allocated at the same address as a freed one,
+ * watch the krb5.conf files as well as the dictionaries.  Returns 0 on
+ * success or a Kerberos error code on failure.
+ */
+static krb5_error_code
+get_moddata(krb5_context ctx, krb5_pwqual_moddata *data)
+{
+    krb5_error_code code;
+
+    /* Reuse the cached module data if it is still valid. */
+    if (cached_data != NULL) {
+        if (ctx == cached_ctx && !strength_policy_changed(cached_data)) {
+            *data = cached_data;
+            return 0;
+        }
+        strength_close(ctx, cached_data);
+        cached_data = NULL;
+        cached_ctx = NULL;
+    }
+
+    /* Initialize new module data and watch the krb5.conf files. */
+    code = strength_init_watched(ctx, NULL, data);
+    if (code != 0)
+        return code;
+    cached_ctx = ctx;
+    cached_data = *data;
+    return 0;
+}
+
+
+/*
+ * Free the cached module data when the module is unloaded.
+ */
+static void __attribute__((__destructor__))
+free_moddata(void)
+{
+    if (cached_data != NULL)
+        strength_close(cached_ctx, cached_data);
+    cached_data = NULL;
+    cached_ctx = NULL;
+}
+
+
 /*
  * This is the single check function that we provide.  It does the glue
- * required to initialize our checks, convert the Heimdal arguments to the
- * strings we expect, and return the result.
+ * required to get our module data, convert the Heimdal arguments to the
+ * strings we expect, and return the result.  The password is copied into a
+ * buffer on the stack rather than allocated unless it is too long to fit.
  */
 static int
 heimdal_pwcheck(krb5_context ctx, krb5_principal principal,
@@ -65,22 +124,25 @@ heimdal_pwcheck(krb5_context ctx, krb5_principal principal,
                 size_t length)
 {
     krb5_pwqual_moddata data = NULL;
-    char *pastring;
+    char buffer[BUFSIZ];
+    char *pastring = buffer;
     char *name = NULL;
     krb5_error_code code;
 
     /* Convert the password to a C string. */
-    pastring = malloc(password->length + 1);
-    if (pastring == NULL) {
-        snprintf(message, length, "cannot allocate memory: %s",
-                 strerror(errno));
-        return 1;
+    if (password->length >= sizeof(buffer)) {
+        pastring = malloc(password->length + 1);
+        if (pastring == NULL) {
+            snprintf(message, length, "cannot allocate memory: %s",
+                     strerror(errno));
+            return 1;
+        }
     }
     memcpy(pastring, password->data, password->length);
     pastring[password->length] = '\0';
 
-    /* Initialize strength checking. */
-    code = strength_init(ctx, NULL, &data);
+    /* Get the module data, initializing it if needed. */
+    code = get_moddata(ctx, &data);
     if (code != 0) {
         convert_error(ctx, code, NULL, message, length);
         goto done;
@@ -100,11 +162,10 @@ heimdal_pwcheck(krb5_context ctx, krb5_principal principal,
 
 done:
     explicit_bzero(pastring, password->length);
-    free(pastring);
+    if (pastring != buffer)
+        free(pastring);
     if (name != NULL)
         krb5_free_unparsed_name(ctx, name);
-    if (data != NULL)
-        strength_close(ctx, data);
     return (code == 0) ? 0 : 1;
 }
 
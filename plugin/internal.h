@@ -4,7 +4,7 @@
  * Developed by Daria Phoebe Brashear and Ken Hornstein of Sine Nomine
  *     Associates, on behalf of Stanford University
  * Extensive modifications by Russ Allbery <eagle@eyrie.org>
- * Copyright 2023 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2023, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2006-2007, 2009, 2012-2014
  *     The Board of Trustees of the Leland Stanford Junior University
  *
@@ -25,6 +25,12 @@
 #    include <sqlite3.h>
 #endif
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+#ifdef HAVE_SYS_SDT_H
+#    include <sys/sdt.h>
+#endif
 
 #ifdef HAVE_KRB5_PWQUAL_PLUGIN_H
 #    include <krb5/pwqual_plugin.h>
@@ -66,6 +72,45 @@ struct class_rule {
     struct class_rule *next;
 };
 
+/* Bits for the character classes present in a password. */
+#define CLASS_LOWER  0x01
+#define CLASS_UPPER  0x02
+#define CLASS_DIGIT  0x04
+#define CLASS_SYMBOL 0x08
+
+/*
+ * A summary of the characters of a password, computed once by
+ * strength_analyze and used by all of the checks that only care about which
+ * characters are present.  seen is a bitmap of the byte values that occur in
+ * the password and unique is the number of bits set in it.
+ */
+struct password_info {
+    size_t length;             /* Length of the password */
+    bool printable;            /* Only printable ASCII characters */
+    bool alpha_space;          /* Only letters and spaces */
+    unsigned int classes;      /* Mask of CLASS_* bits present */
+    unsigned long num_classes; /* Number of character classes present */
+    unsigned long unique;      /* Number of different characters */
+    uint64_t seen[4];          /* Set of byte values present */
+};
+
+/* Implementations of the common prefix and suffix length functions. */
+enum strength_compare {
+    STRENGTH_COMPARE_BEST,
+    STRENGTH_COMPARE_SCALAR,
+    STRENGTH_COMPARE_SSE2,
+    STRENGTH_COMPARE_AVX2
+};
+
+/*
+ * The combined requirements of all character class rules that apply to a
+ * particular password length, built by strength_init_classes.
+ */
+struct class_entry {
+    unsigned int required;     /* Mask of CLASS_* bits required */
+    unsigned long num_classes; /* Minimum number of classes required */
+};
+
 /* Used to store a list of strings, managed by the sync_vector_* functions. */
 struct vector {
     size_t count;
@@ -73,6 +118,122 @@ struct vector {
     char **strings;
 };
 
+/*
+ * A single stage of the password check plan, built by strength_init from the
+ * enabled checks.  Each stage is given the summary of the password from
+ * strength_analyze, which is only computed if some stage needs it.
+ */
+typedef krb5_error_code (*strength_stage)(krb5_context, krb5_pwqual_moddata,
+                                          const char *principal,
+                                          const char *password,
+                                          const struct password_info *);
+
+/* The maximum number of stages in the check plan, one for each check. */
+#define STRENGTH_MAX_STAGES 9
+
+/*
+ * Static tracepoints in the krb5_strength provider, for use with bpftrace,
+ * perf, or SystemTap.  They are only compiled in if <sys/sdt.h> is available,
+ * and are a single no-op instruction unless a tracer is attached.  Probe
+ * arguments must never include password or principal data, only lengths,
+ * check numbers, status codes, and counts of work done, and must be cheap to
+ * compute since they are evaluated whether or not anything is tracing.
+ */
+#ifdef HAVE_SYS_SDT_H
+#    define STRENGTH_PROBE1(name, a) DTRACE_PROBE1(krb5_strength, name, a)
+#    define STRENGTH_PROBE2(name, a, b) \
+        DTRACE_PROBE2(krb5_strength, name, a, b)
+#else
+#    define STRENGTH_PROBE1(name, a)    ((void) (a))
+#    define STRENGTH_PROBE2(name, a, b) ((void) (a), (void) (b))
+#endif
+
+/*
+ * The layout of the shared statistics file, configured with stats_file.  The
+ * file is mapped shared by every process doing checks and by
+ * krb5-strength-stats, and the counters are updated with atomic operations.
+ * There is one set of counters for each check and one for the whole call to
+ * strength_check.  latency[0] counts calls taking less than one microsecond
+ * and latency[n] counts calls taking less than 2^n microseconds but at least
+ * 2^(n-1).  The last bucket also counts all slower calls.
+ */
+#define STRENGTH_STATS_MAGIC   0x6b357374U /* "k5st" */
+#define STRENGTH_STATS_VERSION 1
+#define STRENGTH_STATS_BUCKETS 24
+#define STRENGTH_STATS_NAME    16
+struct strength_stats_counters {
+    char name[STRENGTH_STATS_NAME];           /* Name of the check */
+    uint64_t calls;                           /* Number of times run */
+    uint64_t rejects;                         /* Number of rejections */
+    uint64_t usec;                            /* Total time spent */
+    uint64_t latency[STRENGTH_STATS_BUCKETS]; /* Histogram of times */
+};
+struct strength_stats {
+    uint32_t magic;   /* STRENGTH_STATS_MAGIC */
+    uint32_t version; /* STRENGTH_STATS_VERSION */
+    uint32_t stages;  /* Number of elements of stage */
+    uint32_t buckets; /* STRENGTH_STATS_BUCKETS */
+    struct strength_stats_counters total;
+    struct strength_stats_counters stage[STRENGTH_MAX_STAGES];
+};
+
+/* A snapshot of the krb5.conf settings, opaque outside of config.c. */
+struct strength_config;
+
+/*
+ * The identity of a file used by the module data, recorded by strength_watch
+ * so that strength_watch_changed can tell if the file has been modified or
+ * replaced since.
+ */
+struct strength_watched {
+    char *path;      /* Path to the file */
+    bool exists;     /* Whether the file existed */
+    dev_t device;    /* Device containing the file */
+    ino_t inode;     /* Inode of the file */
+    off_t size;      /* Size of the file */
+    time_t mtime;    /* Last modification time of the file */
+    long mtime_nsec; /* Nanoseconds of mtime, if available */
+};
+
+/*
+ * A policy built from a subsection of the settings named after a realm other
+ * than the default realm or after a kadmin password policy, kept in a
+ * chained hash table in the module data for the default realm.  A realm
+ * without its own subsection is kept with no module data so that it uses the
+ * policy for the default realm.
+ */
+struct strength_policy {
+    uint32_t hash;                /* Hash of the name */
+    char *name;                   /* Name of the realm or kadmin policy */
+    krb5_pwqual_moddata data;     /* Module data for the policy, or NULL */
+    struct strength_policy *next; /* Next policy in the same bucket */
+};
+
+/*
+ * A CDB dictionary for a language, opened only while it is in use.
+ * last_used is when a check last used it, so that it can be closed after
+ * being idle for a while.
+ */
+struct strength_language {
+    char *language;   /* Language the dictionary is for */
+    char *path;       /* Path to the CDB dictionary */
+    int fd;           /* File descriptor if open, otherwise -1 */
+#ifdef HAVE_CDB_H
+    struct cdb cdb;   /* Open CDB dictionary data */
+#endif
+    time_t last_used; /* When a check last used the dictionary */
+};
+
+/* State of a reloadable handle, private to reload.c. */
+struct strength_reload;
+
+/* A hash table of policies, looked up by strength_policy_select. */
+struct strength_policies {
+    struct strength_policy **buckets; /* Chains of policies by hash */
+    size_t size;                      /* Number of buckets */
+    size_t count;                     /* Number of policies */
+};
+
 /*
  * MIT Kerberos uses this type as an abstract data type for any data that a
  * password quality check needs to carry.  Reuse it since then we get type
@@ -84,18 +245,53 @@ struct krb5_pwqual_moddata_st {
     bool ascii;               /* Whether to require printable ASCII */
     bool nonletter;           /* Whether to require a non-letter */
     struct class_rule *rules; /* Linked list of character class rules */
+    struct class_entry *class_table; /* Class rules by password length */
+    size_t class_table_size;         /* Number of entries in class_table */
     char *dictionary;         /* Base path to CrackLib dictionary */
     long cracklib_maxlen;     /* Longer passwords skip CrackLib checks */
-    bool have_cdb;            /* Whether we have a CDB dictionary */
+    bool lazy;                /* Open dictionaries on first use */
+    char *cdb_path;           /* Path to CDB dictionary, if configured */
+    bool have_cdb;            /* Whether the CDB dictionary is open */
     int cdb_fd;               /* File descriptor of CDB dictionary */
 #ifdef HAVE_CDB_H
     struct cdb cdb; /* Open CDB dictionary data */
 #endif
 #ifdef HAVE_SQLITE3_H
+    char *sqlite_path;          /* Path to SQLite dictionary, if configured */
+    long sqlite_cache_size;     /* Page cache size, or 0 for the default */
+    long sqlite_mmap_size;      /* Bytes to map, or 0 for none */
+    bool sqlite_immutable;      /* Whether to open the dictionary immutable */
+    bool sqlite_in_memory;      /* Whether to copy the dictionary to memory */
     sqlite3 *sqlite;            /* Open SQLite database handle */
     sqlite3_stmt *prefix_query; /* Query using the password prefix */
     sqlite3_stmt *suffix_query; /* Query using the reversed password suffix */
+    sqlite3_stmt *exact_query;  /* Exact match query for short passwords */
+    char *scratch;              /* Scratch space for building query bounds */
+    size_t scratch_size;        /* Size of the scratch space */
 #endif
+    unsigned long cdb_lookups;     /* Lookups by the last CDB check */
+    unsigned long sqlite_rows;     /* Rows examined by the last SQLite check */
+    unsigned long cracklib_probes; /* Words compared by last CrackLib check */
+    long slow_check_threshold;     /* Log checks slower than this, in ms */
+    strength_stage plan[STRENGTH_MAX_STAGES]; /* Enabled checks in order */
+    unsigned int plan_ids[STRENGTH_MAX_STAGES]; /* Check number of each */
+    size_t plan_length;                       /* Number of enabled checks */
+    bool plan_analyze; /* Whether any stage needs strength_analyze */
+    struct strength_stats *stats; /* Shared statistics, if configured */
+    struct strength_watched *watched; /* Files the module data depends on */
+    size_t watched_count;             /* Number of elements in watched */
+    struct strength_config *config;   /* Settings, only during strength_init */
+    char *section;                    /* Subsection of settings used */
+    char *init_dictionary;            /* Dictionary given to strength_init */
+    struct strength_policies realms;   /* Policies for other realms */
+    struct strength_policies policies; /* Policies for kadmin policies */
+    struct strength_language *languages; /* Dictionaries by language */
+    size_t languages_count;              /* Number of elements in languages */
+    long language_idle_timeout;          /* Seconds before closing them */
+    long reload_interval;  /* Seconds between checks for changes, or -1 */
+    unsigned long refs;    /* Checks using this snapshot, if reloadable */
+    krb5_pwqual_moddata retired_next; /* Next retired snapshot */
+    struct strength_reload *reload;   /* Reload state, only in a handle */
 };
 
 BEGIN_DECLS
@@ -107,6 +303,16 @@ BEGIN_DECLS
 krb5_error_code strength_init(krb5_context, const char *dictionary,
                               krb5_pwqual_moddata *);
 
+/*
+ * Initialize a policy from a subsection of the settings named after a realm
+ * or kadmin password policy.  strength_init uses this with a NULL section for
+ * the default realm.
+ */
+krb5_error_code strength_init_section(krb5_context, const char *dictionary,
+                                      const char *section,
+                                      krb5_pwqual_moddata *)
+    __attribute__((__nonnull__(1, 4)));
+
 /*
  * Check a password.  Returns 0 if okay.  On error, sets the Kerberos error
  * message and returns a Kerberos status code.
@@ -114,13 +320,39 @@ krb5_error_code strength_init(krb5_context, const char *dictionary,
 krb5_error_code strength_check(krb5_context, krb5_pwqual_moddata,
                                const char *principal, const char *password);
 
+/*
+ * The same, but use the policy for the given kadmin password policy if there
+ * is one and also check the dictionaries for the given NULL-terminated list
+ * of languages.  The MIT plugin uses this.
+ */
+krb5_error_code strength_check_policy(krb5_context, krb5_pwqual_moddata,
+                                      const char *policy,
+                                      const char *principal,
+                                      const char *password,
+                                      const char **languages);
+
+/*
+ * Check a password against every enabled check instead of stopping at the
+ * first failure.  Sets failures to a mask with bit n set if the check named
+ * by strength_check_name(n) rejected the password.  Returns the status of the
+ * first failure in the order the checks are run, with its error message set
+ * in the Kerberos context, or 0 if the password passed every check.
+ */
+krb5_error_code strength_check_all(krb5_context, krb5_pwqual_moddata,
+                                   const char *principal, const char *password,
+                                   unsigned long *failures);
+
+/* Return the name of check n, or NULL if there is no such check. */
+const char *strength_check_name(size_t);
+
 /* Free the internal plugin state. */
 void strength_close(krb5_context, krb5_pwqual_moddata);
 
 /*
  * CDB handling.  strength_init_cdb gets the dictionary configuration and sets
  * up the CDB database, strength_check_cdb checks it, and strength_close_cdb
- * handles freeing resources.
+ * handles freeing resources.  If lazy is set in the module data, init only
+ * checks that the dictionary is readable and the first check opens it.
  *
  * If not built with CDB support, provide some stubs for check and close.
  * init is always a real function, which reports an error if CDB is
@@ -136,6 +368,31 @@ void strength_close_cdb(krb5_context, krb5_pwqual_moddata);
 #    define strength_close_cdb(c, d)    /* empty */
 #endif
 
+/*
+ * Language dictionary handling.  strength_init_languages gets the
+ * configuration of the dictionaries without opening them,
+ * strength_check_languages checks the dictionaries for the given languages,
+ * opening and closing them as needed, and strength_close_languages closes
+ * them all.  strength_cdb_check, shared with the CDB check, checks a password
+ * and its variants against one open CDB dictionary.
+ *
+ * If not built with CDB support, these are stubbed out in the same way as the
+ * CDB functions.
+ */
+krb5_error_code strength_init_languages(krb5_context, krb5_pwqual_moddata);
+#ifdef HAVE_CDB
+krb5_error_code strength_check_languages(krb5_context, krb5_pwqual_moddata,
+                                         const char **languages,
+                                         const char *password);
+void strength_close_languages(krb5_context, krb5_pwqual_moddata);
+krb5_error_code strength_cdb_check(krb5_context, struct cdb *,
+                                   const char *password,
+                                   unsigned long *lookups);
+#else
+#    define strength_check_languages(c, d, l, p) 0
+#    define strength_close_languages(c, d)       /* empty */
+#endif
+
 /*
  * CrackLib handling.  strength_init_cracklib gets the dictionary
  * configuration does some sanity checks on it, and strength_check_cracklib
@@ -157,7 +414,8 @@ krb5_error_code strength_check_cracklib(krb5_context, krb5_pwqual_moddata,
 /*
  * SQLite handling.  strength_init_sqlite gets the database configuration and
  * sets up the SQLite internal data, strength_check_sqlite checks a password,
- * and strength_close_sqlite handles freeing resources.
+ * and strength_close_sqlite handles freeing resources.  As with CDB, if lazy
+ * is set, opening the database is left to the first check.
  *
  * If not built with SQLite support, provide some stubs for check and close.
  * init is always a real function, which reports an error if SQLite is
@@ -173,9 +431,51 @@ void strength_close_sqlite(krb5_context, krb5_pwqual_moddata);
 #    define strength_close_sqlite(c, d)    /* empty */
 #endif
 
-/* Check whether the password statisfies character class requirements. */
+/*
+ * Return the length of the common prefix or common suffix of two strings of
+ * the given lengths, using the fastest implementation this CPU supports.
+ * strength_compare_select overrides that choice for testing, is not
+ * thread-safe, and returns false if the requested implementation isn't
+ * supported on this system.
+ */
+bool strength_compare_select(enum strength_compare);
+size_t strength_common_prefix(const char *, size_t, const char *, size_t)
+    __attribute__((__nonnull__));
+size_t strength_common_suffix(const char *, size_t, const char *, size_t)
+    __attribute__((__nonnull__));
+
+/*
+ * Shared statistics.  strength_stats_open maps the statistics file, creating
+ * and initializing it if names is not NULL, in which case it also sets the
+ * names of the checks from that array of STRENGTH_MAX_STAGES strings.
+ * Otherwise, it is mapped read-only unless writable is true.  Returns NULL
+ * and sets errno on failure.  strength_stats_record adds one call to a set of
+ * counters and strength_stats_reset clears all counters, which requires a
+ * writable mapping.  None of these functions use Kerberos, so they can be
+ * used by tools.
+ */
+struct strength_stats *strength_stats_open(const char *path,
+                                           const char *const *names,
+                                           bool writable)
+    __attribute__((__nonnull__(1)));
+void strength_stats_record(struct strength_stats_counters *, bool rejected,
+                           uint64_t usec) __attribute__((__nonnull__));
+void strength_stats_reset(struct strength_stats *)
+    __attribute__((__nonnull__));
+void strength_stats_close(struct strength_stats *);
+
+/* Summarize the characters of a password in a single pass. */
+void strength_analyze(const char *password, struct password_info *)
+    __attribute__((__nonnull__));
+
+/*
+ * Character class handling.  strength_init_classes loads the character class
+ * rules and compiles them into a table by password length, and
+ * strength_check_classes checks whether the password statisfies them.
+ */
+krb5_error_code strength_init_classes(krb5_context, krb5_pwqual_moddata);
 krb5_error_code strength_check_classes(krb5_context, krb5_pwqual_moddata,
-                                       const char *password);
+                                       const struct password_info *);
 
 /* Check whether the password is based on the principal in some way. */
 krb5_error_code strength_check_principal(krb5_context, krb5_pwqual_moddata,
@@ -207,24 +507,40 @@ struct vector *strength_vector_split_multi(const char *string,
     __attribute__((__nonnull__(1, 2)));
 
 /*
- * Obtain configuration settings from krb5.conf.  These are wrappers around
- * the krb5_appdefault_* APIs that handle setting the section name, obtaining
- * the local default realm and using it to find settings, and doing any
- * necessary conversion.
+ * Obtain configuration settings from krb5.conf.  A snapshot of the settings
+ * for a subsection named after a realm or kadmin policy, normally the local
+ * default realm, is opened at the start of strength_init and closed at the
+ * end, and the getters read from it.  These wrap the krb5_appdefault_* APIs,
+ * handling setting the section name and subsection and doing any necessary
+ * conversion.  strength_config_has_section returns whether there are any
+ * settings specific to a subsection.
  */
-void strength_config_boolean(krb5_context, const char *, bool *)
+krb5_error_code strength_config_open(krb5_context, const char *section,
+                                     struct strength_config **)
+    __attribute__((__nonnull__(1, 3)));
+const char *strength_config_section(const struct strength_config *)
+    __attribute__((__nonnull__));
+bool strength_config_has_section(krb5_context, const char *section)
+    __attribute__((__nonnull__));
+void strength_config_close(krb5_context, struct strength_config *)
+    __attribute__((__nonnull__(1)));
+void strength_config_boolean(krb5_context, struct strength_config *,
+                             const char *, bool *)
     __attribute__((__nonnull__));
-krb5_error_code strength_config_list(krb5_context, const char *,
-                                     struct vector **)
+krb5_error_code strength_config_list(krb5_context, struct strength_config *,
+                                     const char *, struct vector **)
     __attribute__((__nonnull__));
-void strength_config_number(krb5_context, const char *, long *)
+void strength_config_number(krb5_context, struct strength_config *,
+                            const char *, long *)
     __attribute__((__nonnull__));
-void strength_config_string(krb5_context, const char *, char **)
+void strength_config_string(krb5_context, struct strength_config *,
+                            const char *, char **)
     __attribute__((__nonnull__));
 
 /* Parse the more complex configuration of required character classes. */
-krb5_error_code strength_config_classes(krb5_context, const char *,
-                                        struct class_rule **)
+krb5_error_code strength_config_classes(krb5_context,
+                                        struct strength_config *,
+                                        const char *, struct class_rule **)
     __attribute__((__nonnull__));
 
 /*
@@ -245,6 +561,61 @@ krb5_error_code strength_error_system(krb5_context, const char *format, ...)
 krb5_error_code strength_error_tooshort(krb5_context, const char *format, ...)
     __attribute__((__nonnull__, __format__(printf, 2, 3)));
 
+/*
+ * Log an informational message to syslog, and obtain a timestamp in
+ * microseconds for measuring elapsed time.
+ */
+void strength_log_info(const char *format, ...)
+    __attribute__((__nonnull__, __format__(printf, 1, 2)));
+uint64_t strength_timestamp(void);
+
+/*
+ * Track the files that the module data depends on.  strength_watch records
+ * the current identity of a file, strength_watch_changed returns true if any
+ * recorded file has changed, and strength_watch_free frees the records.
+ */
+krb5_error_code strength_watch(krb5_context, krb5_pwqual_moddata,
+                               const char *path);
+bool strength_watch_changed(krb5_pwqual_moddata);
+void strength_watch_free(krb5_pwqual_moddata);
+
+/*
+ * Manage the policies for other realms and kadmin password policies.
+ * strength_policy_init builds the policies named in the policies setting,
+ * strength_policy_select finds the policy to use for a password change given
+ * the name of the kadmin policy, if any, and the principal, and
+ * strength_policy_changed returns true if strength_watch_changed is true for
+ * the module data or any of its policies.
+ */
+krb5_error_code strength_policy_init(krb5_context, krb5_pwqual_moddata);
+krb5_error_code strength_policy_select(krb5_context, krb5_pwqual_moddata,
+                                       const char *name,
+                                       const char *principal,
+                                       krb5_pwqual_moddata *)
+    __attribute__((__nonnull__(1, 2, 5)));
+bool strength_policy_changed(krb5_pwqual_moddata);
+void strength_policy_free(krb5_context, krb5_pwqual_moddata);
+
+/*
+ * Reload the configuration of a long-running plugin.  strength_init_watched
+ * initializes module data that also records the krb5.conf files for
+ * strength_policy_changed.  strength_reload_open creates a handle holding a
+ * snapshot of the module data, strength_reload_acquire returns the snapshot
+ * to use for a check after first asking a background thread to replace it if
+ * reloading is enabled and the configuration has changed,
+ * strength_reload_release must be called when the check is done with it, and
+ * strength_reload_close stops the thread and frees the handle and all of its
+ * snapshots.
+ */
+krb5_error_code strength_init_watched(krb5_context, const char *dictionary,
+                                      krb5_pwqual_moddata *);
+krb5_error_code strength_reload_open(krb5_context, const char *dictionary,
+                                     krb5_pwqual_moddata *);
+krb5_pwqual_moddata strength_reload_acquire(krb5_context, krb5_pwqual_moddata)
+    __attribute__((__nonnull__));
+void strength_reload_release(krb5_pwqual_moddata) __attribute__((__nonnull__));
+void strength_reload_close(krb5_context, krb5_pwqual_moddata);
+
 /* Undo default visibility change. */
 #pragma GCC visibility pop
 
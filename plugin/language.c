@@ -0,0 +1,250 @@
+/*
+ * Check passwords against CDB dictionaries for the languages of the user.
+ *
+ * MIT Kerberos passes the password quality plugin the languages of the user
+ * changing their password.  A CDB dictionary can be configured for each
+ * language, and a password that passes every other check is also checked
+ * against the dictionaries for the user's languages.  Since there may be many
+ * such dictionaries and most are rarely used, none is opened at
+ * initialization, although each must be readable then.  Each is opened the
+ * first time it is needed and is closed again once it has been unused for
+ * language_idle_timeout seconds, which bounds the memory mapped by a
+ * long-running kadmind.  Closing is lazy: idle dictionaries are only closed at
+ * the end of a check that uses the language dictionaries, so they stay open
+ * if no such check happens.  The language dictionaries are not watched for
+ * changes, but since each is opened again after being idle, a replaced
+ * dictionary is picked up once the old one has been closed.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/kadmin.h>
+#include <portable/krb5.h>
+#include <portable/system.h>
+
+#ifdef HAVE_CDB_H
+#    include <cdb.h>
+#endif
+#include <fcntl.h>
+#include <time.h>
+
+#include <plugin/internal.h>
+#include <util/macros.h>
+
+/* Default number of seconds after which an unused dictionary is closed. */
+#define DEFAULT_IDLE_TIMEOUT 300
+
+
+/*
+ * Stub for strength_init_languages if not built with CDB support.
+ */
+#ifndef HAVE_CDB
+krb5_error_code
+strength_init_languages(krb5_context ctx, krb5_pwqual_moddata data)
+{
+    struct vector *config = NULL;
+    krb5_error_code code;
+
+    /* Get the language dictionaries from krb5.conf. */
+    code = strength_config_list(ctx, data->config, "language_dictionary_cdb",
+                                &config);
+    if (code != 0)
+        return code;
+
+    /* If any were set, report an error, since we don't have CDB support. */
+    if (config == NULL)
+        return 0;
+    strength_vector_free(config);
+    krb5_set_error_message(ctx, KADM5_BAD_SERVER_PARAMS,
+                           "language dictionaries requested but not built"
+                           " with CDB support");
+    return KADM5_BAD_SERVER_PARAMS;
+}
+#endif
+
+
+/* Skip the rest of this file if CDB is not available. */
+#ifdef HAVE_CDB
+
+/*
+ * Initialize the language dictionaries.  Parses the language_dictionary_cdb
+ * setting, a list of language:path pairs, and checks that each dictionary is
+ * readable, but doesn't open any of them.  Returns 0 on success, non-zero on
+ * failure (and sets the error in the Kerberos context).
+ */
+krb5_error_code
+strength_init_languages(krb5_context ctx, krb5_pwqual_moddata data)
+{
+    struct vector *config = NULL;
+    struct strength_language *dict;
+    krb5_error_code code;
+    const char *spec, *colon;
+    size_t i;
+
+    /* Get the language dictionaries from krb5.conf. */
+    code = strength_config_list(ctx, data->config, "language_dictionary_cdb",
+                                &config);
+    if (code != 0 || config == NULL)
+        return code;
+    data->language_idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    strength_config_number(ctx, data->config, "language_idle_timeout",
+                           &data->language_idle_timeout);
+
+    /* Allocate and fill in the table of dictionaries. */
+    data->languages = calloc(config->count, sizeof(*data->languages));
+    if (data->languages == NULL) {
+        code = strength_error_system(ctx, "cannot allocate memory");
+        goto done;
+    }
+    for (i = 0; i < config->count; i++) {
+        spec = config->strings[i];
+        colon = strchr(spec, ':');
+        if (colon == NULL || colon == spec || colon[1] == '\0') {
+            code = strength_error_config(ctx,
+                                         "bad language dictionary in"
+                                         " configuration: %s",
+                                         spec);
+            goto done;
+        }
+        dict = &data->languages[i];
+        dict->fd = -1;
+        dict->language = strndup(spec, (size_t) (colon - spec));
+        dict->path = strdup(colon + 1);
+        data->languages_count = i + 1;
+        if (dict->language == NULL || dict->path == NULL) {
+            code = strength_error_system(ctx, "cannot allocate memory");
+            goto done;
+        }
+        if (access(dict->path, R_OK) != 0) {
+            code = strength_error_system(ctx, "cannot read dictionary %s",
+                                         dict->path);
+            goto done;
+        }
+    }
+
+done:
+    strength_vector_free(config);
+    return code;
+}
+
+
+/*
+ * Return true if a configured language applies to a language of the user.  A
+ * configured language applies to the same language and to any more specific
+ * language, so de applies to de-CH but de-CH doesn't apply to de.  Case is
+ * ignored.
+ */
+static bool
+language_matches(const char *configured, const char *language)
+{
+    size_t length = strlen(configured);
+
+    if (strncasecmp(configured, language, length) != 0)
+        return false;
+    return language[length] == '\0' || language[length] == '-'
+           || language[length] == '_';
+}
+
+
+/*
+ * Open a language dictionary if it isn't already open.  Returns 0 on success
+ * or a Kerberos error code if the dictionary could not be opened.
+ */
+static krb5_error_code
+open_language(krb5_context ctx, struct strength_language *dict)
+{
+    krb5_error_code code;
+
+    if (dict->fd != -1)
+        return 0;
+    dict->fd = open(dict->path, O_RDONLY);
+    if (dict->fd < 0)
+        return strength_error_system(ctx, "cannot open dictionary %s",
+                                     dict->path);
+    if (cdb_init(&dict->cdb, dict->fd) < 0) {
+        code = strength_error_system(ctx, "cannot init dictionary %s",
+                                     dict->path);
+        close(dict->fd);
+        dict->fd = -1;
+        return code;
+    }
+    return 0;
+}
+
+
+/*
+ * Close a language dictionary.
+ */
+static void
+close_language(struct strength_language *dict)
+{
+    if (dict->fd == -1)
+        return;
+    cdb_free(&dict->cdb);
+    close(dict->fd);
+    dict->fd = -1;
+}
+
+
+/*
+ * Check a password against the dictionaries for the languages of the user,
+ * given as a NULL-terminated list or NULL if not known.  Afterwards, close
+ * any dictionary that hasn't been used for the idle timeout.  The module data
+ * is only used by one check at a time, so no dictionary can be in use by
+ * another check.  Returns a Kerberos status code, which will be
+ * KADM5_PASS_Q_DICT if the password was found in one of the dictionaries.
+ */
+krb5_error_code
+strength_check_languages(krb5_context ctx, krb5_pwqual_moddata data,
+                         const char **languages, const char *password)
+{
+    struct strength_language *dict;
+    krb5_error_code code = 0;
+    unsigned long lookups = 0;
+    time_t now;
+    size_t i, j;
+
+    now = time(NULL);
+    for (i = 0; code == 0 && languages != NULL && languages[i] != NULL; i++)
+        for (j = 0; code == 0 && j < data->languages_count; j++) {
+            dict = &data->languages[j];
+            if (!language_matches(dict->language, languages[i]))
+                continue;
+            code = open_language(ctx, dict);
+            if (code != 0)
+                break;
+            code = strength_cdb_check(ctx, &dict->cdb, password, &lookups);
+            dict->last_used = now;
+        }
+    for (j = 0; j < data->languages_count; j++) {
+        dict = &data->languages[j];
+        if (now - dict->last_used >= data->language_idle_timeout)
+            close_language(dict);
+    }
+    return code;
+}
+
+
+/*
+ * Close all of the language dictionaries and free the table.
+ */
+void
+strength_close_languages(krb5_context ctx UNUSED, krb5_pwqual_moddata data)
+{
+    size_t i;
+
+    for (i = 0; i < data->languages_count; i++) {
+        close_language(&data->languages[i]);
+        free(data->languages[i].language);
+        free(data->languages[i].path);
+    }
+    free(data->languages);
+    data->languages = NULL;
+    data->languages_count = 0;
+}
+
+#endif /* HAVE_CDB */
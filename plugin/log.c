@@ -0,0 +1,80 @@
+/*
+ * Logging and timing for operational reporting.
+ *
+ * The plugin normally reports problems only through the Kerberos context, but
+ * some information, such as how long it took to load a dictionary, is only
+ * of interest to the system administrator.  Provided here are a helper to
+ * send such messages to syslog and a monotonic clock used to time the work
+ * being reported.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#ifdef HAVE_SYSLOG_H
+#    include <syslog.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+#    include <sys/time.h>
+#endif
+#include <time.h>
+
+#include <plugin/internal.h>
+
+
+/*
+ * Log an informational message to syslog, prefixed with the name of the
+ * module so that it can be distinguished from the messages of the service
+ * that loaded it.  We don't call openlog, since the identity and facility
+ * should be whatever the calling program set up.
+ */
+void
+strength_log_info(const char *format, ...)
+{
+#ifdef HAVE_SYSLOG_H
+    va_list args;
+    char *message;
+    int status;
+
+    va_start(args, format);
+    status = vasprintf(&message, format, args);
+    va_end(args);
+    if (status < 0)
+        return;
+    syslog(LOG_INFO, "krb5-strength: %s", message);
+    free(message);
+#else
+    (void) format;
+#endif
+}
+
+
+/*
+ * Return a timestamp in microseconds.  Only differences between timestamps
+ * are meaningful.  Use the monotonic clock if available so that changes to
+ * the system time don't distort the measurements.
+ */
+uint64_t
+strength_timestamp(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec now;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == 0)
+        return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+#endif
+#ifdef HAVE_SYS_TIME_H
+    {
+        struct timeval tv;
+
+        if (gettimeofday(&tv, NULL) == 0)
+            return (uint64_t) tv.tv_sec * 1000000 + (uint64_t) tv.tv_usec;
+    }
+#endif
+    return (uint64_t) time(NULL) * 1000000;
+}
@@ -34,33 +34,41 @@ krb5_error_code pwqual_strength_initvt(krb5_context, int, int,
 
 
 /*
- * Initialize the library.  We can't just call pwcheck_init, since currently
- * kadmind doesn't tell us the dictionary path.  So first look up where the
- * dictionary is, and then call pwcheck_init.
+ * Initialize the library.  kadmind keeps the module data until it exits, so
+ * give it a handle that can be pointed at new module data when the
+ * configuration changes.
  */
 static krb5_error_code
 init(krb5_context ctx, const char *dictionary, krb5_pwqual_moddata *data)
 {
-    return strength_init(ctx, dictionary, data);
+    return strength_reload_open(ctx, dictionary, data);
 }
 
 
 /*
  * Check the password.  We need to transform the principal passed us by kadmind
- * into a string for our check.
+ * into a string for our check.  The name of the kadmin policy of the
+ * principal selects the policy built for it, if any, and the languages of the
+ * user select the language dictionaries to check.  The check uses the current
+ * module data for the handle, which is first reloaded if it is time to look
+ * for configuration changes and there are any.
  */
 static krb5_error_code
 check(krb5_context ctx, krb5_pwqual_moddata data, const char *password,
-      const char *policy_name UNUSED, krb5_principal princ,
-      const char **languages UNUSED)
+      const char *policy_name, krb5_principal princ,
+      const char **languages)
 {
+    krb5_pwqual_moddata snapshot;
     char *name = NULL;
     krb5_error_code code;
 
     code = krb5_unparse_name(ctx, princ, &name);
     if (code != 0)
         return code;
-    code = strength_check(ctx, data, name, password);
+    snapshot = strength_reload_acquire(ctx, data);
+    code = strength_check_policy(ctx, snapshot, policy_name, name, password,
+                                 languages);
+    strength_reload_release(snapshot);
     krb5_free_unparsed_name(ctx, name);
     return code;
 }
@@ -72,7 +80,7 @@ check(krb5_context ctx, krb5_pwqual_moddata data, const char *password,
 static void
 fini(krb5_context ctx, krb5_pwqual_moddata data)
 {
-    strength_close(ctx, data);
+    strength_reload_close(ctx, data);
 }
 
 
@@ -0,0 +1,332 @@
+/*
+ * Password policies for other realms and for kadmin password policies.
+ *
+ * The module data built by strength_init holds the policy for the default
+ * realm.  Other policies are built from a subsection of the krb5-strength
+ * settings, which krb5_appdefault_* finds when given the name of the
+ * subsection in place of the realm.  Each such policy is a complete module
+ * data of its own, with its own plan, character class table, and
+ * dictionaries, and is kept in a hash table in the module data for the
+ * default realm.
+ *
+ * A principal in any other realm is checked against the policy for its own
+ * realm if there is a subsection of the settings for that realm.  That policy
+ * is built the first time a principal in that realm is checked so that
+ * configuration is never parsed again for that realm.  Otherwise, the
+ * principal is checked against the policy for the default realm, and the
+ * realm is remembered so that its settings aren't looked up again.  Realms
+ * are seen as principals are checked, so only a limited number of realms
+ * without their own settings are remembered.  The policies
+ * named in the policies setting are built when the module is initialized and
+ * are used for passwords of principals with a kadmin password policy of the
+ * same name.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/krb5.h>
+#include <portable/system.h>
+
+#include <plugin/internal.h>
+#include <util/macros.h>
+
+/* Number of buckets in a hash table when it is first created. */
+#define POLICY_BUCKETS 8
+
+/* Maximum number of realms without their own settings to remember. */
+#define POLICY_LIMIT 256
+
+
+/*
+ * Return the realm of a principal, which follows the first @ that isn't
+ * escaped with a backslash, or NULL if the principal has no realm.
+ */
+static const char *
+find_realm(const char *principal)
+{
+    const char *p;
+
+    for (p = principal; *p != '\0'; p++) {
+        if (*p == '\\' && p[1] != '\0')
+            p++;
+        else if (*p == '@')
+            return (p[1] == '\0') ? NULL : p + 1;
+    }
+    return NULL;
+}
+
+
+/*
+ * Hash the name of a policy with 32-bit FNV-1a.
+ */
+static uint32_t
+hash_name(const char *name)
+{
+    const unsigned char *p;
+    uint32_t hash = 2166136261U;
+
+    for (p = (const unsigned char *) name; *p != '\0'; p++) {
+        hash ^= *p;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+
+/*
+ * Look up a policy by name in a hash table.  Returns its entry, or NULL if
+ * there is no policy by that name.
+ */
+static const struct strength_policy *
+find_entry(const struct strength_policies *table, const char *name)
+{
+    const struct strength_policy *entry;
+    uint32_t hash;
+
+    if (table->size == 0)
+        return NULL;
+    hash = hash_name(name);
+    for (entry = table->buckets[hash % table->size]; entry != NULL;
+         entry = entry->next)
+        if (entry->hash == hash && strcmp(entry->name, name) == 0)
+            return entry;
+    return NULL;
+}
+
+
+/*
+ * Look up a policy by name in a hash table.  Returns its module data, or NULL
+ * if there is no policy by that name or it uses the default policy.
+ */
+static krb5_pwqual_moddata
+find_policy(const struct strength_policies *table, const char *name)
+{
+    const struct strength_policy *entry;
+
+    entry = find_entry(table, name);
+    return (entry == NULL) ? NULL : entry->data;
+}
+
+
+/*
+ * Double the number of buckets in a hash table, or create it if it doesn't
+ * exist, and move every policy into its new bucket.  Returns 0 on success or
+ * a Kerberos error code if memory allocation fails.
+ */
+static krb5_error_code
+grow_policies(krb5_context ctx, struct strength_policies *table)
+{
+    struct strength_policy **buckets;
+    struct strength_policy *entry, *next;
+    size_t i, size;
+
+    size = (table->size == 0) ? POLICY_BUCKETS : table->size * 2;
+    buckets = calloc(size, sizeof(*buckets));
+    if (buckets == NULL)
+        return strength_error_system(ctx, "cannot allocate memory");
+    for (i = 0; i < table->size; i++)
+        for (entry = table->buckets[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            entry->next = buckets[entry->hash % size];
+            buckets[entry->hash % size] = entry;
+        }
+    free(table->buckets);
+    table->buckets = buckets;
+    table->size = size;
+    return 0;
+}
+
+
+/*
+ * Add a policy to a hash table under the given name.  If build is true, build
+ * the policy from the subsection of the settings with that name, using the
+ * same dictionary given to strength_init for data, and store the new module
+ * data in policy.  Otherwise, record that the name uses the default policy
+ * and leave policy unchanged.  Returns 0 on success or a Kerberos error code
+ * on failure.
+ */
+static krb5_error_code
+add_policy(krb5_context ctx, krb5_pwqual_moddata data,
+           struct strength_policies *table, const char *name, bool build,
+           krb5_pwqual_moddata *policy)
+{
+    struct strength_policy *entry;
+    krb5_error_code code;
+
+    /* Grow the table first so that adding the policy can't fail. */
+    if (table->count >= table->size) {
+        code = grow_policies(ctx, table);
+        if (code != 0)
+            return code;
+    }
+    entry = calloc(1, sizeof(*entry));
+    if (entry == NULL)
+        return strength_error_system(ctx, "cannot allocate memory");
+    entry->name = strdup(name);
+    if (entry->name == NULL) {
+        free(entry);
+        return strength_error_system(ctx, "cannot allocate memory");
+    }
+    if (build) {
+        code = strength_init_section(ctx, data->init_dictionary, name,
+                                     &entry->data);
+        if (code != 0) {
+            free(entry->name);
+            free(entry);
+            return code;
+        }
+        *policy = entry->data;
+    }
+    entry->hash = hash_name(name);
+    entry->next = table->buckets[entry->hash % table->size];
+    table->buckets[entry->hash % table->size] = entry;
+    table->count++;
+    return 0;
+}
+
+
+/*
+ * Free all of the policies in a hash table.
+ */
+static void
+free_policies(krb5_context ctx, struct strength_policies *table)
+{
+    struct strength_policy *entry, *next;
+    size_t i;
+
+    for (i = 0; i < table->size; i++)
+        for (entry = table->buckets[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            if (entry->data != NULL)
+                strength_close(ctx, entry->data);
+            free(entry->name);
+            free(entry);
+        }
+    free(table->buckets);
+    table->buckets = NULL;
+    table->size = 0;
+    table->count = 0;
+}
+
+
+/*
+ * Build the policies named in the policies setting.  Called by strength_init
+ * while the configuration snapshot for the default realm is still open.
+ * Returns 0 on success or a Kerberos error code on failure.
+ */
+krb5_error_code
+strength_policy_init(krb5_context ctx, krb5_pwqual_moddata data)
+{
+    struct vector *names = NULL;
+    krb5_pwqual_moddata policy;
+    krb5_error_code code;
+    size_t i;
+
+    code = strength_config_list(ctx, data->config, "policies", &names);
+    if (code != 0 || names == NULL)
+        return code;
+    for (i = 0; i < names->count; i++) {
+        if (find_policy(&data->policies, names->strings[i]) != NULL)
+            continue;
+        code = add_policy(ctx, data, &data->policies, names->strings[i],
+                          true, &policy);
+        if (code != 0)
+            break;
+    }
+    strength_vector_free(names);
+    return code;
+}
+
+
+/*
+ * Find the policy for a password change and store it in policy.  If the kadmin
+ * password policy of the principal is given and is one of the policies
+ * named in the policies setting, that is the policy.  Otherwise, if the
+ * principal has no realm, is in the realm of data, or is in a realm without
+ * its own subsection of the settings, the policy is data itself.  Otherwise,
+ * it is the policy for that realm, which is built if this is the first
+ * principal seen in that realm.  Returns 0 on success or a Kerberos error
+ * code if the policy could not be built.
+ */
+krb5_error_code
+strength_policy_select(krb5_context ctx, krb5_pwqual_moddata data,
+                       const char *name, const char *principal,
+                       krb5_pwqual_moddata *policy)
+{
+    const struct strength_policy *entry;
+    const char *realm;
+
+    /* Use the named policy if there is one. */
+    *policy = NULL;
+    if (name != NULL)
+        *policy = find_policy(&data->policies, name);
+    if (*policy != NULL)
+        return 0;
+
+    /* Use data itself if the principal isn't in some other realm. */
+    *policy = data;
+    if (principal == NULL)
+        return 0;
+    realm = find_realm(principal);
+    if (realm == NULL)
+        return 0;
+    if (data->section != NULL && strcmp(realm, data->section) == 0)
+        return 0;
+
+    /*
+     * Use the policy for the realm if it has one, building it if needed.  Once
+     * the limit is reached, realms without their own settings are no longer
+     * remembered, so their settings are looked up again each time.
+     */
+    entry = find_entry(&data->realms, realm);
+    if (entry != NULL) {
+        if (entry->data != NULL)
+            *policy = entry->data;
+        return 0;
+    }
+    if (strength_config_has_section(ctx, realm))
+        return add_policy(ctx, data, &data->realms, realm, true, policy);
+    if (data->realms.count >= POLICY_LIMIT)
+        return 0;
+    return add_policy(ctx, data, &data->realms, realm, false, policy);
+}
+
+
+/*
+ * Return true if any of the files used by data or by any of its policies has
+ * changed according to strength_watch_changed.
+ */
+bool
+strength_policy_changed(krb5_pwqual_moddata data)
+{
+    const struct strength_policies *tables[2];
+    const struct strength_policy *entry;
+    size_t i, j;
+
+    if (strength_watch_changed(data))
+        return true;
+    tables[0] = &data->realms;
+    tables[1] = &data->policies;
+    for (i = 0; i < ARRAY_SIZE(tables); i++)
+        for (j = 0; j < tables[i]->size; j++)
+            for (entry = tables[i]->buckets[j]; entry != NULL;
+                 entry = entry->next)
+                if (entry->data != NULL && strength_watch_changed(entry->data))
+                    return true;
+    return false;
+}
+
+
+/*
+ * Free all of the policies for other realms and kadmin password policies.
+ */
+void
+strength_policy_free(krb5_context ctx, krb5_pwqual_moddata data)
+{
+    free_policies(ctx, &data->realms);
+    free_policies(ctx, &data->policies);
+}
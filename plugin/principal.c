@@ -7,7 +7,7 @@
  *
  * Developed by Daria Phoebe Brashear and Ken Hornstein of Sine Nomine
  * Associates, on behalf of Stanford University Extensive modifications by Russ
- * Allbery <eagle@eyrie.org> Copyright 2020 Russ Allbery <eagle@eyrie.org>
+ * Allbery <eagle@eyrie.org> Copyright 2020, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2006-2007, 2009, 2012-2014
  *     The Board of Trustees of the Leland Stanford Junior University
  *
@@ -24,71 +24,76 @@
 
 
 /*
- * Given a string taken from the principal, check if the password matches that
- * string or is that string with leading or trailing digits added.  If so,
- * sets the Kerberos error and returns a non-zero error code.  Otherwise,
- * returns 0.
+ * The password being checked, along with the length of its runs of leading
+ * and trailing digits.  These are computed once and used for every
+ * component of the principal.
+ */
+struct password_digits {
+    const char *password;
+    size_t length;
+    size_t leading;
+    size_t trailing;
+};
+
+
+/*
+ * Given a string taken from the principal and its length, check if the
+ * password matches that string, that string reversed, or that string with
+ * leading or trailing digits added.  Case is ignored.  If so, sets the
+ * Kerberos error and returns a non-zero error code.  Otherwise, returns 0.
+ *
+ * The component is not nul-terminated, so all comparisons use its length.
  */
 static krb5_error_code
-check_component(krb5_context ctx, const char *component, const char *password)
+check_component(krb5_context ctx, const char *component, size_t complength,
+                const struct password_digits *pw)
 {
-    char *copy;
-    size_t i, j, complength, passlength;
-    char c;
-
-    /* Check if the password is a simple match for the component. */
-    if (strcasecmp(component, password) == 0)
-        return strength_error_generic(ctx, ERROR_USERNAME);
+    const char *password = pw->password;
+    size_t i, passlength;
 
     /*
      * If the length of the password matches the length of the component,
-     * check for a reversed match.
+     * check for a simple match or a reversed match.
      */
-    complength = strlen(component);
-    passlength = strlen(password);
+    passlength = pw->length;
     if (complength == passlength) {
-        copy = strdup(component);
-        if (copy == NULL)
-            return strength_error_system(ctx, "cannot allocate memory");
-        for (i = 0, j = complength - 1; i < j; i++, j--) {
-            c = copy[i];
-            copy[i] = copy[j];
-            copy[j] = c;
-        }
-        if (strcasecmp(copy, password) == 0) {
-            explicit_bzero(copy, strlen(copy));
-            free(copy);
+        if (strncasecmp(component, password, complength) == 0)
             return strength_error_generic(ctx, ERROR_USERNAME);
-        }
-        free(copy);
+        for (i = 0; i < complength; i++)
+            if (tolower((unsigned char) component[complength - i - 1])
+                != tolower((unsigned char) password[i]))
+                break;
+        if (i == complength)
+            return strength_error_generic(ctx, ERROR_USERNAME);
+        return 0;
     }
 
     /*
      * We've checked everything we care about unless the password is longer
      * than the component.
      */
-    if (passlength <= complength)
+    if (passlength < complength)
         return 0;
 
     /*
      * Check whether the user just added leading or trailing digits to the
-     * component of the principal to form the password.
+     * component of the principal to form the password.  Only the first
+     * occurrence of the component in the password is considered.  For it to
+     * be a match, all characters before it must be digits, so it must start
+     * within the leading run of digits, and all characters after it must be
+     * digits, so it must end within the trailing run of digits.  If the
+     * component doesn't occur within the leading digits, either it doesn't
+     * occur or its first occurrence isn't a match.  This also means that
+     * components of the wrong length can be rejected without looking at
+     * them.
      */
-    for (i = 0; i <= passlength - complength; i++) {
+    if (complength + pw->leading + pw->trailing < passlength)
+        return 0;
+    for (i = 0; i <= pw->leading && i <= passlength - complength; i++) {
         if (strncasecmp(password + i, component, complength) != 0)
             continue;
-
-        /*
-         * For this to be a match, all characters from 0 to i - 1 must be
-         * digits, and all characters from strlen(component) + i to
-         * strlen(password) - 1 must be digits.
-         */
-        for (j = 0; j < i; j++)
-            if (!isdigit((unsigned char) password[j]))
-                return 0;
-        for (j = complength + i; j < passlength; j++)
-            if (!isdigit((unsigned char) password[j]))
-                return 0;
+        if (i + complength + pw->trailing < passlength)
+            return 0;
 
         /* The password was formed by adding digits to this component. */
         return strength_error_generic(ctx, ERROR_USERNAME);
@@ -121,34 +126,42 @@ is_separator(unsigned char c)
  * underscore bits between other characters) and the remaining principal from
  * that point forward (to catch, for example, the entire realm).  Returns 0 if
  * it is not and some non-zero error code if it appears to be.
+ *
+ * Components are handled as pointers into the principal and lengths, so no
+ * copies of the principal or password are made.
  */
 krb5_error_code
 strength_check_principal(krb5_context ctx, krb5_pwqual_moddata data UNUSED,
                          const char *principal, const char *password)
 {
+    struct password_digits pw;
     krb5_error_code code;
-    char *copy, *start;
-    size_t i, length;
+    size_t i, start, length;
 
     /* Sanity check. */
     if (principal == NULL)
         return 0;
 
+    /* Find the runs of leading and trailing digits in the password. */
+    pw.password = password;
+    pw.length = strlen(password);
+    for (i = 0; i < pw.length && isdigit((unsigned char) password[i]); i++)
+        ;
+    pw.leading = i;
+    for (i = 0; i < pw.length; i++)
+        if (!isdigit((unsigned char) password[pw.length - i - 1]))
+            break;
+    pw.trailing = i;
+
     /* Start with checking the entire principal. */
-    code = check_component(ctx, principal, password);
+    length = strlen(principal);
+    code = check_component(ctx, principal, length, &pw);
     if (code != 0)
         return code;
 
-    /*
-     * Make a copy of the principal and scan forward past any leading
-     * separators.
-     */
-    length = strlen(principal);
-    copy = strdup(principal);
-    if (copy == NULL)
-        return strength_error_system(ctx, "cannot allocate memory");
+    /* Scan forward past any leading separators. */
     i = 0;
-    while (copy[i] != '\0' && is_separator(copy[i]))
+    while (i < length && is_separator(principal[i]))
         i++;
 
     /*
@@ -157,37 +170,24 @@ strength_check_principal(krb5_context ctx, krb5_pwqual_moddata data UNUSED,
      */
     do {
         if (i != 0) {
-            code = check_component(ctx, copy + i, password);
-            if (code != 0) {
-                explicit_bzero(copy, strlen(copy));
-                free(copy);
+            code = check_component(ctx, principal + i, length - i, &pw);
+            if (code != 0)
                 return code;
-            }
         }
 
-        /* Set the component start and then scan for a separator. */
-        start = copy + i;
-        while (i < length && !is_separator(copy[i]))
+        /* Find the end of the component and check it. */
+        start = i;
+        while (i < length && !is_separator(principal[i]))
             i++;
-
-        /* At end of string or a separator.  Truncate the component. */
-        copy[i] = '\0';
-
-        /* Check the current component. */
-        code = check_component(ctx, start, password);
-        if (code != 0) {
-            explicit_bzero(copy, strlen(copy));
-            free(copy);
+        code = check_component(ctx, principal + start, i - start, &pw);
+        if (code != 0)
             return code;
-        }
 
         /* Scan forward past any more separators. */
-        while (i < length && is_separator(copy[i]))
+        while (i < length && is_separator(principal[i]))
             i++;
     } while (i < length);
 
     /* Password does not appear to be based on the principal. */
-    explicit_bzero(copy, strlen(copy));
-    free(copy);
     return 0;
 }
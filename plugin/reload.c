@@ -0,0 +1,445 @@
+/*
+ * Reload the configuration of a long-running plugin.
+ *
+ * The MIT Kerberos plugin is initialized once when kadmind starts, so changes
+ * to krb5.conf or to the dictionaries would otherwise require restarting
+ * kadmind.  Instead, the module data given to kadmind is a handle pointing to
+ * the current snapshot of the module data.  If reload_interval is set, at most
+ * once per that many seconds a check looks at whether krb5.conf or any of the
+ * dictionaries has changed and, if so, wakes a reload thread to build a new
+ * snapshot, so that the check itself isn't delayed.  The thread is started
+ * the first time it is needed rather than when the plugin is initialized,
+ * since kadmind may fork into the background after that.  Only when the new
+ * snapshot is complete is it published by atomically replacing the pointer in
+ * the handle, so checks never see a partially built snapshot and a snapshot
+ * that fails to build leaves the old one in place.
+ *
+ * Each check holds a reference to the snapshot it uses, so checks already in
+ * progress finish against the old snapshot.  A replaced snapshot is kept on a
+ * list of retired snapshots and freed by the reload thread once no check
+ * holds a reference to it, or when the plugin is closed.  A check may have
+ * loaded the pointer to a snapshot but not yet taken its reference, so
+ * retired snapshots are only freed once no check is between those two steps,
+ * which ensures every check that could still use one has been counted.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/krb5.h>
+#include <portable/system.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+#include <plugin/internal.h>
+
+/*
+ * Atomic operations on the published snapshot and its reference count.  The
+ * pointer is published with sequentially consistent ordering, so that a check
+ * that sees the new snapshot also sees everything written while building it,
+ * and so that the reload thread's later look at how many checks are taking a
+ * reference can't be reordered before the publication.
+ */
+#if defined(__GNUC__)
+#    define PTR_LOAD(p)     __atomic_load_n(&(p), __ATOMIC_SEQ_CST)
+#    define PTR_STORE(p, v) __atomic_store_n(&(p), (v), __ATOMIC_SEQ_CST)
+#    define REFS_ADD(c, n)  __atomic_add_fetch(&(c), (n), __ATOMIC_SEQ_CST)
+#    define FLAG_SET(f)     __atomic_exchange_n(&(f), 1, __ATOMIC_ACQUIRE)
+#    define FLAG_CLEAR(f)   __atomic_store_n(&(f), 0, __ATOMIC_RELEASE)
+#else
+#    define PTR_LOAD(p)     (p)
+#    define PTR_STORE(p, v) ((p) = (v))
+#    define REFS_ADD(c, n)  ((c) += (n))
+#    define FLAG_SET(f)     ((f)++)
+#    define FLAG_CLEAR(f)   ((f) = 0)
+#endif
+
+/*
+ * The state of a handle, kept in the reload field of the module data given
+ * to kadmind.  All other fields of that module data are unused.
+ */
+struct strength_reload {
+    krb5_pwqual_moddata current; /* Snapshot used for new checks */
+    krb5_pwqual_moddata retired; /* Replaced snapshots not yet freed */
+    char *dictionary;            /* Dictionary given to strength_reload_open */
+    time_t next_check;           /* When to next look for changes */
+    int reloading;               /* Whether a reload is in progress */
+    unsigned long acquiring;     /* Checks taking a reference to a snapshot */
+    krb5_context ctx;            /* Kerberos context of the reload thread */
+    pthread_t thread;            /* Thread building new snapshots */
+    pthread_mutex_t lock;        /* Protects the fields below */
+    pthread_cond_t wakeup;       /* Signaled when there is work to do */
+    bool started;                /* Whether the reload thread is running */
+    bool pending;                /* Whether the reload thread has work */
+    bool rebuild;                /* Whether to build a new snapshot */
+    bool stopping;               /* Whether the reload thread should exit */
+};
+
+
+/*
+ * Record the krb5.conf files in the module data.  Heimdal provides a function
+ * to get the list of files.  MIT Kerberos does not, so use the same rule as
+ * the MIT library: KRB5_CONFIG if it is set and otherwise /etc/krb5.conf.
+ * Returns 0 on success or a Kerberos error code on failure.
+ */
+#ifdef HAVE_KRB5_GET_DEFAULT_CONFIG_FILES
+
+static krb5_error_code
+watch_config(krb5_context ctx, krb5_pwqual_moddata data)
+{
+    char **files = NULL;
+    krb5_error_code code;
+    size_t i;
+
+    code = krb5_get_default_config_files(&files);
+    for (i = 0; code == 0 && files[i] != NULL; i++)
+        code = strength_watch(ctx, data, files[i]);
+    if (files != NULL)
+        krb5_free_config_files(files);
+    return code;
+}
+
+#else /* !HAVE_KRB5_GET_DEFAULT_CONFIG_FILES */
+
+static krb5_error_code
+watch_config(krb5_context ctx, krb5_pwqual_moddata data)
+{
+    struct vector *files;
+    krb5_error_code code = 0;
+    const char *path;
+    size_t i;
+
+    path = getenv("KRB5_CONFIG");
+    if (path == NULL)
+        path = "/etc/krb5.conf";
+    files = strength_vector_split_multi(path, ":", NULL);
+    if (files == NULL)
+        return strength_error_system(ctx, "cannot allocate memory");
+    for (i = 0; code == 0 && i < files->count; i++)
+        code = strength_watch(ctx, data, files->strings[i]);
+    strength_vector_free(files);
+    return code;
+}
+
+#endif /* !HAVE_KRB5_GET_DEFAULT_CONFIG_FILES */
+
+
+/*
+ * Initialize module data and record the krb5.conf files along with the
+ * dictionaries, so that strength_policy_changed also reports changes to the
+ * configuration.  Returns 0 on success or a Kerberos error code on failure.
+ */
+krb5_error_code
+strength_init_watched(krb5_context ctx, const char *dictionary,
+                      krb5_pwqual_moddata *data)
+{
+    krb5_error_code code;
+
+    code = strength_init(ctx, dictionary, data);
+    if (code != 0)
+        return code;
+    code = watch_config(ctx, *data);
+    if (code != 0) {
+        strength_close(ctx, *data);
+        *data = NULL;
+    }
+    return code;
+}
+
+
+/*
+ * Create a handle for a reloadable plugin with an initial snapshot built
+ * from the current configuration.  Returns 0 on success or a Kerberos error
+ * code on failure.
+ */
+krb5_error_code
+strength_reload_open(krb5_context ctx, const char *dictionary,
+                     krb5_pwqual_moddata *handle)
+{
+    struct strength_reload *reload;
+    krb5_error_code code;
+
+    *handle = calloc(1, sizeof(**handle));
+    if (*handle == NULL)
+        return strength_error_system(ctx, "cannot allocate memory");
+    reload = calloc(1, sizeof(*reload));
+    if (reload == NULL) {
+        code = strength_error_system(ctx, "cannot allocate memory");
+        goto fail;
+    }
+    pthread_mutex_init(&reload->lock, NULL);
+    pthread_cond_init(&reload->wakeup, NULL);
+    (*handle)->reload = reload;
+    if (dictionary != NULL) {
+        reload->dictionary = strdup(dictionary);
+        if (reload->dictionary == NULL) {
+            code = strength_error_system(ctx, "cannot allocate memory");
+            goto fail;
+        }
+    }
+    code = strength_init_watched(ctx, dictionary, &reload->current);
+    if (code != 0)
+        goto fail;
+    reload->next_check = time(NULL) + reload->current->reload_interval;
+    return 0;
+
+fail:
+    strength_reload_close(ctx, *handle);
+    *handle = NULL;
+    return code;
+}
+
+
+/*
+ * Free every retired snapshot that no check is using.  Only called by the
+ * reload thread, so the list itself needs no locking.  Nothing is freed while
+ * a check is taking a reference, since it may have loaded the pointer to a
+ * retired snapshot without having counted its reference yet.  Every snapshot
+ * on the list was retired before this check, so once no check is taking a
+ * reference, the reference count of each includes every check using it.
+ */
+static void
+free_retired(struct strength_reload *reload)
+{
+    krb5_pwqual_moddata data, *prev;
+
+    if (REFS_ADD(reload->acquiring, 0) != 0)
+        return;
+    prev = &reload->retired;
+    while (*prev != NULL) {
+        data = *prev;
+        if (REFS_ADD(data->refs, 0) != 0) {
+            prev = &data->retired_next;
+            continue;
+        }
+        PTR_STORE(*prev, data->retired_next);
+        strength_close(reload->ctx, data);
+    }
+}
+
+
+/*
+ * Free the retired snapshots that no check is using and, if requested, build
+ * and publish a new snapshot.  Only called by the reload thread, which is the
+ * only writer of the current snapshot.  A failure to build the new snapshot
+ * is logged and the current snapshot is kept.
+ */
+static void
+reload_snapshot(struct strength_reload *reload, bool rebuild)
+{
+    krb5_pwqual_moddata current, data;
+    krb5_error_code code;
+    const char *message;
+
+    free_retired(reload);
+    if (!rebuild)
+        return;
+    code = strength_init_watched(reload->ctx, reload->dictionary, &data);
+    if (code != 0) {
+        message = krb5_get_error_message(reload->ctx, code);
+        strength_log_info("keeping old configuration, reload failed: %s",
+                          message);
+        krb5_free_error_message(reload->ctx, message);
+        return;
+    }
+    current = reload->current;
+    PTR_STORE(reload->current, data);
+    current->retired_next = reload->retired;
+    PTR_STORE(reload->retired, current);
+    strength_log_info("reloaded configuration");
+}
+
+
+/*
+ * The reload thread.  Waits until a check asks it to do something, does it,
+ * and then allows checks to ask again, until the handle is closed.
+ */
+static void *
+reload_thread(void *arg)
+{
+    struct strength_reload *reload = arg;
+    bool rebuild;
+
+    pthread_mutex_lock(&reload->lock);
+    for (;;) {
+        while (!reload->pending && !reload->stopping)
+            pthread_cond_wait(&reload->wakeup, &reload->lock);
+        if (reload->stopping)
+            break;
+        reload->pending = false;
+        rebuild = reload->rebuild;
+        pthread_mutex_unlock(&reload->lock);
+        reload_snapshot(reload, rebuild);
+        FLAG_CLEAR(reload->reloading);
+        pthread_mutex_lock(&reload->lock);
+    }
+    pthread_mutex_unlock(&reload->lock);
+    return NULL;
+}
+
+
+/*
+ * Ask the reload thread to free retired snapshots and, if rebuild is true, to
+ * build a new snapshot, starting the thread if it isn't running.  The thread
+ * gets its own copy of the Kerberos context, since a context can't be used by
+ * two threads at once, and blocks all signals so that they are still
+ * delivered to kadmind's own threads.  Returns 0 on success or a Kerberos
+ * error code if the thread could not be started.
+ */
+static krb5_error_code
+wake_reload(krb5_context ctx, struct strength_reload *reload, bool rebuild)
+{
+    krb5_error_code code = 0;
+    sigset_t all, old;
+    int status;
+
+    pthread_mutex_lock(&reload->lock);
+    if (!reload->started) {
+        code = krb5_copy_context(ctx, &reload->ctx);
+        if (code != 0)
+            goto done;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        status = pthread_create(&reload->thread, NULL, reload_thread, reload);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if (status != 0) {
+            krb5_free_context(reload->ctx);
+            reload->ctx = NULL;
+            errno = status;
+            code = strength_error_system(ctx, "cannot start reload thread");
+            goto done;
+        }
+        reload->started = true;
+    }
+    reload->rebuild = rebuild;
+    reload->pending = true;
+    pthread_cond_signal(&reload->wakeup);
+
+done:
+    pthread_mutex_unlock(&reload->lock);
+    return code;
+}
+
+
+/*
+ * If reloading is enabled and it's time, check whether the configuration or
+ * any dictionary has changed and, if so, ask the reload thread to build a
+ * new snapshot.  The reload thread is also woken if there are retired
+ * snapshots that may now be freed.  If a reload is already in progress, skip
+ * this.  A failure to start the reload thread is logged and the current
+ * snapshot is kept.
+ */
+static void
+maybe_reload(krb5_context ctx, struct strength_reload *reload)
+{
+    krb5_pwqual_moddata current;
+    krb5_error_code code;
+    const char *message;
+    bool rebuild;
+    time_t now;
+
+    current = PTR_LOAD(reload->current);
+    if (current->reload_interval < 0)
+        return;
+    now = time(NULL);
+    if (now < reload->next_check)
+        return;
+    if (FLAG_SET(reload->reloading))
+        return;
+    reload->next_check = now + current->reload_interval;
+    rebuild = strength_policy_changed(current);
+    if (!rebuild && PTR_LOAD(reload->retired) == NULL) {
+        FLAG_CLEAR(reload->reloading);
+        return;
+    }
+    code = wake_reload(ctx, reload, rebuild);
+    if (code != 0) {
+        message = krb5_get_error_message(ctx, code);
+        strength_log_info("keeping old configuration, reload failed: %s",
+                          message);
+        krb5_free_error_message(ctx, message);
+        FLAG_CLEAR(reload->reloading);
+    }
+}
+
+
+/*
+ * Get the snapshot to use for a check, first asking for a reload if needed,
+ * and take a reference to it.  The reference is only kept if the snapshot is
+ * still current after taking it, so a retired snapshot only gains a reference
+ * briefly while a check races with its replacement.  The count of checks
+ * taking a reference keeps the reload thread from freeing a snapshot during
+ * that race.  Always succeeds, since failing to reload only keeps the current
+ * snapshot.
+ */
+krb5_pwqual_moddata
+strength_reload_acquire(krb5_context ctx, krb5_pwqual_moddata handle)
+{
+    struct strength_reload *reload = handle->reload;
+    krb5_pwqual_moddata data;
+
+    maybe_reload(ctx, reload);
+    REFS_ADD(reload->acquiring, 1);
+    for (;;) {
+        data = PTR_LOAD(reload->current);
+        REFS_ADD(data->refs, 1);
+        if (PTR_LOAD(reload->current) == data)
+            break;
+        REFS_ADD(data->refs, -1);
+    }
+    REFS_ADD(reload->acquiring, -1);
+    return data;
+}
+
+
+/*
+ * Drop the reference to a snapshot taken by strength_reload_acquire.
+ */
+void
+strength_reload_release(krb5_pwqual_moddata data)
+{
+    REFS_ADD(data->refs, -1);
+}
+
+
+/*
+ * Free a handle along with its current and retired snapshots, first stopping
+ * the reload thread if it was started.  No checks may be in progress.
+ */
+void
+strength_reload_close(krb5_context ctx, krb5_pwqual_moddata handle)
+{
+    struct strength_reload *reload;
+    krb5_pwqual_moddata data;
+
+    if (handle == NULL)
+        return;
+    reload = handle->reload;
+    if (reload != NULL) {
+        if (reload->started) {
+            pthread_mutex_lock(&reload->lock);
+            reload->stopping = true;
+            pthread_cond_signal(&reload->wakeup);
+            pthread_mutex_unlock(&reload->lock);
+            pthread_join(reload->thread, NULL);
+            krb5_free_context(reload->ctx);
+        }
+        pthread_mutex_destroy(&reload->lock);
+        pthread_cond_destroy(&reload->wakeup);
+        while (reload->retired != NULL) {
+            data = reload->retired;
+            reload->retired = data->retired_next;
+            strength_close(ctx, data);
+        }
+        strength_close(ctx, reload->current);
+        free(reload->dictionary);
+        free(reload);
+    }
+    free(handle);
+}
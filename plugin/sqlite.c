@@ -10,8 +10,9 @@
  * To find passwords within edit distance one, this algorithm checks, for each
  * dictionary word, whether the length of longest common prefix plus the
  * length of the longest common suffix between that word and the password is
- * within 1 of the length of the password.  It will be one less if a letter
- * has been removed or replaced, and equal if the password is an exact match.
+ * within 1 of the length of the longer of the two.  It will be one less if a
+ * letter has been added, removed, or replaced, and equal if the password is
+ * an exact match.
  *
  * To do this, the SQLite database contains one row for each dictionary word,
  * containing both the word and the reversed version of the word.  The
@@ -20,16 +21,35 @@
  * the prefix and the prefix with its last character incremented, and then
  * against all words where the word reversed falls lexicographically between
  * the suffix reversed and the suffix reversed with its last character
- * incremented.
+ * incremented.  The reversed word is only used to find that range; the
+ * common suffix is computed by comparing from the ends of the strings.
  *
  * If the password matches a dictionary word, the edit must either be in the
  * first half of the password or the last half of the password.  If in the
  * first half, the word it will match will fall in the prefix range.  If in
  * the last half, the word it will match will fall in the suffix range.
  *
+ * This breaks down for very short passwords.  A password of two or three
+ * characters has a one-character prefix, and the range of words starting
+ * with that character is a large fraction of the whole dictionary.  The work
+ * done for such a password would grow with the size of the dictionary.  For
+ * those passwords, we instead generate every string within edit distance one
+ * of the password and look each up with an exact match.  This is a fixed
+ * number of indexed lookups regardless of the size of the dictionary.  Both
+ * methods reject exactly the passwords within edit distance one of a word,
+ * so which one is used never changes the result.
+ *
+ * Longer passwords can still fall in a crowded range, such as a password of
+ * four or five characters whose two-character prefix is common.  So the range
+ * check gives up once it has examined about as many rows as checking every
+ * variant would take, and the password is checked by variants instead.  This
+ * bounds the work for any password of up to MAX_VARIANT_LENGTH characters
+ * regardless of dictionary size.  Longer passwords have prefixes and
+ * suffixes long enough that their ranges are small.
+ *
  * Written by Russ Allbery <eagle@eyrie.org>
  * Based on work by David Mazières
- * Copyright 2016, 2020, 2023 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2016, 2020, 2023, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2014
  *     The Board of Trustees of the Leland Stanford Junior University
  *
@@ -52,27 +72,56 @@
  * The prefix and suffix SQLite query.  Finds all candidate words in range of
  * the prefix or suffix.  The prefix query should get bind variables for the
  * prefix and the prefix with the last character incremented; the suffix query
- * gets the same, but the suffix should be reversed.
+ * gets the same, but the suffix should be reversed.  The exact query, used
+ * for short passwords, just checks whether a word is in the dictionary.
  */
 /* clang-format off */
+#define EXACT_QUERY \
+    "SELECT 1 FROM passwords WHERE password = ?;"
 #define PREFIX_QUERY \
-    "SELECT password, drowssap FROM passwords WHERE password BETWEEN ? AND ?;"
+    "SELECT password FROM passwords WHERE password BETWEEN ? AND ?;"
 #define SUFFIX_QUERY \
-    "SELECT password, drowssap FROM passwords WHERE drowssap BETWEEN ? AND ?;"
+    "SELECT password FROM passwords WHERE drowssap BETWEEN ? AND ?;"
 /* clang-format on */
 
+/*
+ * Passwords whose prefix would be shorter than this are checked by looking up
+ * each string within edit distance one rather than by prefix and suffix
+ * ranges.  See the comment at the start of this file.
+ */
+#define MIN_RANGE_PREFIX 2
+
+/*
+ * The longest password that may be checked by looking up each string within
+ * edit distance one if the prefix and suffix ranges turn out to be too
+ * large.  Longer passwords always use the ranges.
+ */
+#define MAX_VARIANT_LENGTH 64
+
+/*
+ * Size of the scratch buffer allocated at initialization and used to build
+ * the query bounds, which need about one and a half times the length of the
+ * password.  Longer passwords fall back on allocating a temporary buffer.
+ */
+#define SCRATCH_SIZE 1024
+
+/* Prefix and suffix for the URI used to open an immutable database. */
+#define IMMUTABLE_PREFIX "file:"
+#define IMMUTABLE_SUFFIX "?immutable=1"
+
 
 /*
  * Stub for strength_init_sqlite if not built with SQLite support.
  */
 #ifndef HAVE_SQLITE3
 krb5_error_code
-strength_init_sqlite(krb5_context ctx, krb5_pwqual_moddata data UNUSED)
+strength_init_sqlite(krb5_context ctx, krb5_pwqual_moddata data)
 {
     char *path = NULL;
 
     /* Get CDB dictionary path from krb5.conf. */
-    strength_config_string(ctx, "password_dictionary_sqlite", &path);
+    strength_config_string(ctx, data->config, "password_dictionary_sqlite",
+                           &path);
 
     /* If it was set, report an error, since we don't have SQLite support. */
     if (path == NULL)
@@ -117,52 +166,155 @@ error_sqlite(krb5_context ctx, krb5_pwqual_moddata data, const char *format,
 
 
 /*
- * Given a string, returns a reversed version of that string in newly
- * allocated memory.  The caller is responsible for freeing.  Returns NULL on
- * memory allocation failure.
+ * Copy the last length characters of a string of total length size into
+ * buffer, reversed.  The result is not nul-terminated.
+ */
+static void
+reverse_suffix(char *buffer, const char *string, size_t size, size_t length)
+{
+    size_t i;
+
+    for (i = 0; i < length; i++)
+        buffer[i] = string[size - i - 1];
+}
+
+
+/*
+ * Given the path to a database, return a SQLite URI that opens that database
+ * with the immutable flag set, in newly allocated memory.  Characters that
+ * have special meaning in a URI are percent-encoded.  The caller is
+ * responsible for freeing.  Returns NULL on memory allocation failure.
  */
 static char *
-reverse_string(const char *string)
+immutable_uri(const char *path)
 {
-    size_t length, i;
-    char *reversed;
+    static const char hex[] = "0123456789ABCDEF";
+    size_t length;
+    const unsigned char *p;
+    char *uri, *q;
 
-    length = strlen(string);
-    reversed = malloc(length + 1);
-    if (reversed == NULL)
+    length = strlen(IMMUTABLE_PREFIX) + strlen(path) * 3;
+    length += strlen(IMMUTABLE_SUFFIX) + 1;
+    uri = malloc(length);
+    if (uri == NULL)
         return NULL;
-    reversed[length] = '\0';
-    for (i = 0; i < length; i++)
-        reversed[length - i - 1] = string[i];
-    return reversed;
+    q = uri + strlen(IMMUTABLE_PREFIX);
+    memcpy(uri, IMMUTABLE_PREFIX, strlen(IMMUTABLE_PREFIX));
+    for (p = (const unsigned char *) path; *p != '\0'; p++)
+        if (*p == '%' || *p == '?' || *p == '#' || *p <= ' ' || *p >= 0x7f) {
+            *q++ = '%';
+            *q++ = hex[*p >> 4];
+            *q++ = hex[*p & 0xf];
+        } else {
+            *q++ = (char) *p;
+        }
+    memcpy(q, IMMUTABLE_SUFFIX, strlen(IMMUTABLE_SUFFIX) + 1);
+    return uri;
 }
 
 
 /*
- * Given two strings, return the length of their common prefix, not counting
- * the nul character that terminates either string.
+ * Apply a numeric PRAGMA setting to the open database.  Takes the Kerberos
+ * context, the module data, the name of the pragma, and the value.  Returns 0
+ * on success, non-zero on failure (and sets the error in the Kerberos
+ * context).
  */
-static size_t
-common_prefix_length(const char *a, const char *b)
+static krb5_error_code
+set_pragma(krb5_context ctx, krb5_pwqual_moddata data, const char *pragma,
+           long value)
 {
-    size_t i;
+    char *sql;
+    int status;
 
-    for (i = 0; a[i] == b[i] && a[i] != '\0'; i++)
-        ;
-    return i;
+    if (asprintf(&sql, "PRAGMA %s = %ld;", pragma, value) < 0)
+        return strength_error_system(ctx, "cannot allocate memory");
+    status = sqlite3_exec(data->sqlite, sql, NULL, NULL, NULL);
+    free(sql);
+    if (status != SQLITE_OK)
+        return error_sqlite(ctx, data, "cannot set %s", pragma);
+    return 0;
 }
 
 
 /*
- * Given the length of the password, the password, the reversed password, and
- * an executed SQLite statement that contains the word and reversed word as
- * the first two column texts, determine whether this password is a match
- * within edit distance one.
+ * Copy the open on-disk dictionary into an in-memory database using the
+ * SQLite backup API and replace the database handle in the module data with
+ * the in-memory copy.  Logs how long this took and how much memory the copy
+ * uses.  Returns 0 on success, non-zero on failure (and sets the error in the
+ * Kerberos context).
+ */
+static krb5_error_code
+load_into_memory(krb5_context ctx, krb5_pwqual_moddata data, const char *path)
+{
+    sqlite3 *disk = data->sqlite;
+    sqlite3 *memory = NULL;
+    sqlite3_backup *backup;
+    uint64_t start, elapsed;
+    int current, highwater, status;
+    krb5_error_code code;
+
+    /* Create the in-memory database that will receive the copy. */
+    start = strength_timestamp();
+    status = sqlite3_open_v2(":memory:", &memory,
+                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX,
+                             NULL);
+    if (status != SQLITE_OK) {
+        data->sqlite = memory;
+        code = error_sqlite(ctx, data, "cannot create in-memory database");
+        goto fail;
+    }
+
+    /*
+     * Copy the whole database in one step.  Errors from the backup API are
+     * reported against the destination database.
+     */
+    backup = sqlite3_backup_init(memory, "main", disk, "main");
+    if (backup == NULL) {
+        data->sqlite = memory;
+        code = error_sqlite(ctx, data, "cannot load %s into memory", path);
+        goto fail;
+    }
+    sqlite3_backup_step(backup, -1);
+    status = sqlite3_backup_finish(backup);
+    if (status != SQLITE_OK) {
+        data->sqlite = memory;
+        code = error_sqlite(ctx, data, "cannot load %s into memory", path);
+        goto fail;
+    }
+
+    /* Switch to the in-memory database and report the cost. */
+    elapsed = strength_timestamp() - start;
+    sqlite3_close(disk);
+    data->sqlite = memory;
+    status = sqlite3_db_status(memory, SQLITE_DBSTATUS_CACHE_USED, &current,
+                               &highwater, 0);
+    if (status != SQLITE_OK)
+        current = 0;
+    strength_log_info("loaded SQLite dictionary %s into memory in %lu.%03lu"
+                      " ms using %d bytes",
+                      path, (unsigned long) (elapsed / 1000),
+                      (unsigned long) (elapsed % 1000), current);
+    return 0;
+
+fail:
+    sqlite3_close(disk);
+    return code;
+}
+
+
+/*
+ * Given the length of the password, the password, and an executed SQLite
+ * statement that contains the word as the first column, determine whether
+ * this password is a match within edit distance one.
  *
  * It will be a match if the length of the common prefix of the password and
- * word plus the length of the common prefix of the reversed password and the
- * reversed word (which is the length of the common suffix) is greater than or
- * equal to the length of the password minus one.
+ * word plus the length of their common suffix is greater than or equal to the
+ * length of the longer of the two minus one.  Every character outside the
+ * common prefix and suffix then belongs to a single change, deletion, or
+ * addition.  Using the length of the password instead would also accept a
+ * word one character longer with a change next to the addition, such as the
+ * password "aXa" and the word "aYYa", which is two edits away and would not
+ * be found by check_variants.
  *
  * To see why the sum of the prefix and suffix length can be longer than the
  * length of the password when the password doesn't match the word, consider
@@ -172,15 +324,21 @@ common_prefix_length(const char *a, const char *b)
  * the word.
  */
 static bool
-match(size_t length, const char *password, const char *drowssap,
-      sqlite3_stmt *query)
+match(size_t length, const char *password, sqlite3_stmt *query)
 {
-    const char *word, *drow;
-    size_t prefix_length, suffix_length, match_length, word_length;
+    const char *word;
+    size_t prefix_length, suffix_length, match_length, word_length, longest;
 
-    /* Discard all words whose length is too different. */
+    /*
+     * Discard all words whose length is too different.  Get the length from
+     * SQLite, which already knows it, rather than scanning the word.  This
+     * must be called after sqlite3_column_text so that it returns the length
+     * of the UTF-8 text.
+     */
     word = (const char *) sqlite3_column_text(query, 0);
-    word_length = strlen(word);
+    if (word == NULL)
+        return false;
+    word_length = (size_t) sqlite3_column_bytes(query, 0);
     if (length > word_length + 1 || length + 1 < word_length)
         return false;
 
@@ -188,62 +346,318 @@ match(size_t length, const char *password, const char *drowssap,
      * Get the common prefix length and check if the password is an exact
      * match.
      */
-    prefix_length = common_prefix_length(password, word);
+    prefix_length = strength_common_prefix(password, length, word, word_length);
     if (prefix_length == length)
         return true;
 
     /*
      * Ensure there aren't too many different characters for this to be a
      * match.  If the common prefix and the common suffix together have a
-     * length that's more than one character shorter than the password length,
-     * this is different by at least edit distance two.  The sum of the
-     * lengths of the common prefix and suffix can be greater than length in
-     * cases of an edit in the middle of repeated passwords, such as the
-     * password "baaab" and the word "baab", but those are all matches.
+     * length that's more than one character shorter than the longer of the
+     * password and the word, this is different by at least edit distance
+     * two.  The sum of the lengths of the common prefix and suffix can be
+     * greater than that in cases of an edit in the middle of repeated
+     * passwords, such as the password "baaab" and the word "baab", but those
+     * are all matches.
      */
-    drow = (const char *) sqlite3_column_text(query, 1);
-    suffix_length = common_prefix_length(drowssap, drow);
+    suffix_length = strength_common_suffix(password, length, word, word_length);
     match_length = prefix_length + suffix_length;
-    return (match_length > length || length - match_length <= 1);
+    longest = (word_length > length) ? word_length : length;
+    return (match_length + 1 >= longest);
 }
 
 
 /*
- * Initialize the SQLite dictionary.  Opens the database and compiles the two
- * queries that we'll use.  Returns 0 on success, non-zero on failure (and
- * sets the error in the Kerberos context).
+ * Look up a single word in the dictionary with an exact match and set the
+ * found parameter to true if it is present.  Returns a Kerberos status code,
+ * which will be 0 on success and something else on failure.
  */
-krb5_error_code
-strength_init_sqlite(krb5_context ctx, krb5_pwqual_moddata data)
+static krb5_error_code
+lookup_exact(krb5_context ctx, krb5_pwqual_moddata data, const char *word,
+             size_t length, bool *found)
 {
-    char *path = NULL;
     int status;
 
-    /* Get SQLite dictionary path from krb5.conf. */
-    strength_config_string(ctx, "password_dictionary_sqlite", &path);
+    *found = false;
+    data->sqlite_rows++;
+    status = sqlite3_bind_text(data->exact_query, 1, word, (int) length,
+                               SQLITE_STATIC);
+    if (status != SQLITE_OK)
+        return error_sqlite(ctx, data, "cannot bind exact match");
+    status = sqlite3_step(data->exact_query);
+    if (status != SQLITE_ROW && status != SQLITE_DONE) {
+        sqlite3_reset(data->exact_query);
+        return error_sqlite(ctx, data, "error searching for exact match");
+    }
+    *found = (status == SQLITE_ROW);
+    status = sqlite3_reset(data->exact_query);
+    if (status != SQLITE_OK)
+        return error_sqlite(ctx, data, "error resetting exact match query");
+    return 0;
+}
 
-    /* If there is no configured dictionary, nothing to do. */
-    if (path == NULL)
-        return 0;
 
-    /* Open the database. */
-    status = sqlite3_open_v2(path, &data->sqlite, SQLITE_OPEN_READONLY, NULL);
-    if (status != 0)
-        return error_sqlite(ctx, data, "cannot open dictionary %s", path);
+/*
+ * Macro used to make variant checks more readable.  Assumes that the found
+ * and fail labels are available for the abort cases of finding a variant or
+ * failing to look it up.
+ */
+#    define CHECK_VARIANT(ctx, data, word, length)                  \
+        do {                                                        \
+            code = lookup_exact(ctx, data, word, length, &found);   \
+            if (code != 0)                                          \
+                goto fail;                                          \
+            if (found)                                              \
+                goto found;                                         \
+        } while (0)
+
+
+/*
+ * Check a short password by looking up every string within edit distance one
+ * of it: the password itself, the password with each character deleted,
+ * each character replaced by any other byte, and any byte inserted at each
+ * position.  Sets result to true if any of those strings is in the
+ * dictionary.  The password must be no longer than MAX_VARIANT_LENGTH.
+ * Returns a Kerberos status code, which will be 0 on success and something
+ * else on failure.
+ */
+static krb5_error_code
+check_variants(krb5_context ctx, krb5_pwqual_moddata data,
+               const char *password, size_t length, bool *result)
+{
+    char variant[MAX_VARIANT_LENGTH + 1];
+    krb5_error_code code;
+    size_t i;
+    int c;
+    bool found;
+
+    /* Check the password itself. */
+    CHECK_VARIANT(ctx, data, password, length);
+
+    /* Check with each character deleted. */
+    for (i = 0; i < length; i++) {
+        memcpy(variant, password, i);
+        memcpy(variant + i, password + i + 1, length - i - 1);
+        CHECK_VARIANT(ctx, data, variant, length - 1);
+    }
+
+    /* Check with each character replaced. */
+    memcpy(variant, password, length);
+    for (i = 0; i < length; i++) {
+        for (c = 1; c <= UCHAR_MAX; c++) {
+            if (c == (unsigned char) password[i])
+                continue;
+            variant[i] = (char) c;
+            CHECK_VARIANT(ctx, data, variant, length);
+        }
+        variant[i] = password[i];
+    }
+
+    /*
+     * Check with a character inserted at each position.  Inserting a copy of
+     * the following character is the same as inserting it after that
+     * character, so skip those duplicates.
+     */
+    for (i = 0; i <= length; i++) {
+        memcpy(variant, password, i);
+        memcpy(variant + i + 1, password + i, length - i);
+        for (c = 1; c <= UCHAR_MAX; c++) {
+            if (i < length && c == (unsigned char) password[i])
+                continue;
+            variant[i] = (char) c;
+            CHECK_VARIANT(ctx, data, variant, length + 1);
+        }
+    }
+
+    /* No variant found. */
+    explicit_bzero(variant, sizeof(variant));
+    return 0;
+
+found:
+    *result = true;
+    code = 0;
+
+fail:
+    explicit_bzero(variant, sizeof(variant));
+    return code;
+}
+
+
+/*
+ * Return the most rows the prefix and suffix range queries may examine for a
+ * password of the given length before it is checked by variants instead.
+ * This is the number of lookups check_variants does, so checking a password
+ * never takes much more than twice that.  There is no limit for passwords too
+ * long for check_variants.
+ */
+static unsigned long
+range_limit(size_t length)
+{
+    if (length > MAX_VARIANT_LENGTH)
+        return ULONG_MAX;
+    return 1 + length + UCHAR_MAX * (2 * (unsigned long) length + 1);
+}
+
+
+/*
+ * Finalize the prepared queries and close the database, leaving the module
+ * data as if the database had never been opened.
+ */
+static void
+close_database(krb5_pwqual_moddata data)
+{
+    if (data->prefix_query != NULL)
+        sqlite3_finalize(data->prefix_query);
+    if (data->suffix_query != NULL)
+        sqlite3_finalize(data->suffix_query);
+    if (data->exact_query != NULL)
+        sqlite3_finalize(data->exact_query);
+    if (data->sqlite != NULL)
+        sqlite3_close(data->sqlite);
+    data->prefix_query = NULL;
+    data->suffix_query = NULL;
+    data->exact_query = NULL;
+    data->sqlite = NULL;
+}
+
+
+/*
+ * Open the SQLite dictionary.  Opens the database, optionally copies it into
+ * memory, applies any tuning settings from krb5.conf, and compiles the
+ * queries that we'll use.  Returns 0 on success, non-zero on failure (and
+ * sets the error in the Kerberos context).  On failure, nothing is left open,
+ * so a later check can try again.
+ *
+ * The database is opened without SQLite's per-connection mutex.  The
+ * prepared statements stored in the module data can't be used by more than
+ * one thread at a time anyway, so the mutex would protect nothing.
+ */
+static krb5_error_code
+open_database(krb5_context ctx, krb5_pwqual_moddata data)
+{
+    const char *path = data->sqlite_path;
+    krb5_error_code code;
+    char *uri = NULL;
+    int flags, status;
+
+    /*
+     * Open the database.  If it is marked immutable, we have to open it via a
+     * URI so that SQLite will skip all locking and change detection.
+     */
+    flags = SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX;
+    if (data->sqlite_immutable) {
+        uri = immutable_uri(path);
+        if (uri == NULL)
+            return strength_error_system(ctx, "cannot allocate memory");
+        flags |= SQLITE_OPEN_URI;
+    }
+    status = sqlite3_open_v2(uri != NULL ? uri : path, &data->sqlite, flags,
+                             NULL);
+    free(uri);
+    if (status != SQLITE_OK) {
+        code = error_sqlite(ctx, data, "cannot open dictionary %s", path);
+        goto fail;
+    }
+
+    /*
+     * If requested, copy the dictionary into memory so that checks never
+     * touch the file.  The memory-mapping setting is irrelevant in that case,
+     * but the cache size still applies to the in-memory copy.
+     */
+    if (data->sqlite_in_memory) {
+        code = load_into_memory(ctx, data, path);
+        if (code != 0)
+            goto fail;
+    }
+
+    /* Apply any tuning settings. */
+    if (data->sqlite_cache_size != 0) {
+        code = set_pragma(ctx, data, "cache_size", data->sqlite_cache_size);
+        if (code != 0)
+            goto fail;
+    }
+    if (data->sqlite_mmap_size > 0 && !data->sqlite_in_memory) {
+        code = set_pragma(ctx, data, "mmap_size", data->sqlite_mmap_size);
+        if (code != 0)
+            goto fail;
+    }
 
     /* Precompile the queries we'll use. */
     status = sqlite3_prepare_v2(data->sqlite, PREFIX_QUERY, -1,
                                 &data->prefix_query, NULL);
-    if (status != 0)
-        return error_sqlite(ctx, data, "cannot prepare prefix query");
+    if (status != SQLITE_OK) {
+        code = error_sqlite(ctx, data, "cannot prepare prefix query");
+        goto fail;
+    }
     status = sqlite3_prepare_v2(data->sqlite, SUFFIX_QUERY, -1,
                                 &data->suffix_query, NULL);
-    if (status != 0)
-        return error_sqlite(ctx, data, "cannot prepare suffix query");
-
-    /* Finished.  Return success. */
-    free(path);
+    if (status != SQLITE_OK) {
+        code = error_sqlite(ctx, data, "cannot prepare suffix query");
+        goto fail;
+    }
+    status = sqlite3_prepare_v2(data->sqlite, EXACT_QUERY, -1,
+                                &data->exact_query, NULL);
+    if (status != SQLITE_OK) {
+        code = error_sqlite(ctx, data, "cannot prepare exact match query");
+        goto fail;
+    }
     return 0;
+
+fail:
+    close_database(data);
+    return code;
+}
+
+
+/*
+ * Initialize the SQLite dictionary.  Reads the dictionary settings from
+ * krb5.conf and opens the database, or if lazy initialization was requested,
+ * only checks that the database is readable and leaves opening it to the
+ * first check.  Returns 0 on success, non-zero on failure (and sets the error
+ * in the Kerberos context).
+ */
+krb5_error_code
+strength_init_sqlite(krb5_context ctx, krb5_pwqual_moddata data)
+{
+    krb5_error_code code;
+
+    /* Get SQLite dictionary path from krb5.conf. */
+    strength_config_string(ctx, data->config, "password_dictionary_sqlite",
+                           &data->sqlite_path);
+
+    /* If there is no configured dictionary, nothing to do. */
+    if (data->sqlite_path == NULL)
+        return 0;
+
+    /* Get the SQLite tuning settings from krb5.conf. */
+    strength_config_number(ctx, data->config, "sqlite_cache_size",
+                           &data->sqlite_cache_size);
+    strength_config_boolean(ctx, data->config, "sqlite_immutable",
+                            &data->sqlite_immutable);
+    strength_config_boolean(ctx, data->config, "sqlite_in_memory",
+                            &data->sqlite_in_memory);
+    strength_config_number(ctx, data->config, "sqlite_mmap_size",
+                           &data->sqlite_mmap_size);
+
+    /* Allocate the scratch space used to build query bounds. */
+    data->scratch = malloc(SCRATCH_SIZE);
+    if (data->scratch == NULL)
+        return strength_error_system(ctx, "cannot allocate memory");
+    data->scratch_size = SCRATCH_SIZE;
+
+    /* Open the database, or just check it if opening it lazily. */
+    if (data->lazy) {
+        if (access(data->sqlite_path, R_OK) != 0)
+            return strength_error_system(ctx, "cannot read dictionary %s",
+                                         data->sqlite_path);
+    } else {
+        code = open_database(ctx, data);
+        if (code != 0)
+            return code;
+    }
+
+    /* Note the dictionary so that callers can tell if it is replaced. */
+    return strength_watch(ctx, data, data->sqlite_path);
 }
 
 
@@ -260,15 +674,25 @@ strength_check_sqlite(krb5_context ctx, krb5_pwqual_moddata data,
     krb5_error_code code;
     size_t length;
     int prefix_length, suffix_length;
-    char *prefix = NULL;
-    char *drowssap = NULL;
+    size_t needed;
+    char *buffer, *prefix_end, *suffix_start, *suffix_end;
+    unsigned long limit, prefix_rows;
     bool found = false;
+    bool too_many = false;
     int status;
 
     /* If we have no dictionary, there is nothing to do. */
-    if (data->sqlite == NULL)
+    data->sqlite_rows = 0;
+    if (data->sqlite_path == NULL)
         return 0;
 
+    /* Open the dictionary if that was deferred to the first check. */
+    if (data->sqlite == NULL) {
+        code = open_database(ctx, data);
+        if (code != 0)
+            return code;
+    }
+
     /*
      * Determine the length of the prefix and suffix into which we'll divide
      * the string.  Passwords shorter than two characters cannot be
@@ -279,32 +703,61 @@ strength_check_sqlite(krb5_context ctx, krb5_pwqual_moddata data,
     length = strlen(password);
     if (length < 2 || length > INT_MAX)
         return 0;
+    STRENGTH_PROBE1(sqlite_entry, length);
     prefix_length = (int) length / 2;
     suffix_length = (int) length - prefix_length;
 
-    /* Obtain the reversed password, used for suffix checks. */
-    drowssap = reverse_string(password);
-    if (drowssap == NULL)
-        return strength_error_system(ctx, "cannot allocate memory");
+    /*
+     * Short passwords would require scanning a large slice of the dictionary,
+     * so check them by exact lookups of each variant instead.
+     */
+    if (prefix_length < MIN_RANGE_PREFIX) {
+        code = check_variants(ctx, data, password, length, &found);
+        STRENGTH_PROBE1(sqlite_variants, data->sqlite_rows);
+        if (code == 0 && found)
+            code = strength_error_dict(ctx, ERROR_DICT);
+        STRENGTH_PROBE2(sqlite_return, code, data->sqlite_rows);
+        return code;
+    }
+    limit = range_limit(length);
 
-    /* Set up the query for prefix matching. */
-    prefix = strdup(password);
-    if (prefix == NULL) {
-        code = strength_error_system(ctx, "cannot allocate memory");
-        goto fail;
+    /*
+     * Build the upper bound of the prefix range and the bounds of the suffix
+     * range in the scratch buffer, one after another.  Only passwords too
+     * long to fit need a temporary buffer.
+     */
+    needed = (size_t) prefix_length + 2 * (size_t) suffix_length;
+    if (needed <= data->scratch_size)
+        buffer = data->scratch;
+    else {
+        buffer = malloc(needed);
+        if (buffer == NULL) {
+            code = strength_error_system(ctx, "cannot allocate memory");
+            STRENGTH_PROBE2(sqlite_return, code, data->sqlite_rows);
+            return code;
+        }
     }
+    prefix_end = buffer;
+    suffix_start = prefix_end + prefix_length;
+    suffix_end = suffix_start + suffix_length;
+    memcpy(prefix_end, password, (size_t) prefix_length);
+    prefix_end[prefix_length - 1]++;
+    reverse_suffix(suffix_start, password, length, (size_t) suffix_length);
+    memcpy(suffix_end, suffix_start, (size_t) suffix_length);
+    suffix_end[prefix_length - 1]++;
+
+    /* Set up the query for prefix matching. */
     status = sqlite3_bind_text(data->prefix_query, 1, password, prefix_length,
-                               NULL);
+                               SQLITE_STATIC);
     if (status != SQLITE_OK) {
         code = error_sqlite(ctx, data, "cannot bind prefix start");
-        goto fail;
+        goto done;
     }
-    prefix[prefix_length - 1]++;
-    status =
-        sqlite3_bind_text(data->prefix_query, 2, prefix, prefix_length, NULL);
+    status = sqlite3_bind_text(data->prefix_query, 2, prefix_end,
+                               prefix_length, SQLITE_STATIC);
     if (status != SQLITE_OK) {
         code = error_sqlite(ctx, data, "cannot bind prefix end");
-        goto fail;
+        goto done;
     }
 
     /*
@@ -312,37 +765,43 @@ strength_check_sqlite(krb5_context ctx, krb5_pwqual_moddata data,
      * the same prefix and, for each, check whether our password matches that
      * entry within edit distance one.
      */
-    while ((status = sqlite3_step(data->prefix_query)) == SQLITE_ROW)
-        if (match(length, password, drowssap, data->prefix_query)) {
+    while ((status = sqlite3_step(data->prefix_query)) == SQLITE_ROW) {
+        if (++data->sqlite_rows > limit) {
+            too_many = true;
+            break;
+        }
+        if (match(length, password, data->prefix_query)) {
             found = true;
             break;
         }
+    }
+    STRENGTH_PROBE1(sqlite_prefix, data->sqlite_rows);
     if (status != SQLITE_DONE && status != SQLITE_ROW) {
         code = error_sqlite(ctx, data, "error searching by password prefix");
-        goto fail;
+        goto done;
     }
     status = sqlite3_reset(data->prefix_query);
     if (status != SQLITE_OK) {
         code = error_sqlite(ctx, data, "error resetting prefix query");
-        goto fail;
+        goto done;
     }
     if (found)
         goto found;
+    if (too_many)
+        goto variants;
 
     /* Set up the query for suffix matching. */
-    status = sqlite3_bind_text(data->suffix_query, 1, drowssap, suffix_length,
-                               SQLITE_TRANSIENT);
+    status = sqlite3_bind_text(data->suffix_query, 1, suffix_start,
+                               suffix_length, SQLITE_STATIC);
     if (status != SQLITE_OK) {
         code = error_sqlite(ctx, data, "cannot bind suffix start");
-        goto fail;
+        goto done;
     }
-    drowssap[prefix_length - 1]++;
-    status = sqlite3_bind_text(data->suffix_query, 2, drowssap, suffix_length,
-                               SQLITE_TRANSIENT);
-    drowssap[prefix_length - 1]--;
+    status = sqlite3_bind_text(data->suffix_query, 2, suffix_end,
+                               suffix_length, SQLITE_STATIC);
     if (status != SQLITE_OK) {
         code = error_sqlite(ctx, data, "cannot bind suffix end");
-        goto fail;
+        goto done;
     }
 
     /*
@@ -350,40 +809,59 @@ strength_check_sqlite(krb5_context ctx, krb5_pwqual_moddata data,
      * the same prefix and, for each, check whether our password matches that
      * entry within edit distance one.
      */
-    while ((status = sqlite3_step(data->suffix_query)) == SQLITE_ROW)
-        if (match(length, password, drowssap, data->suffix_query)) {
+    prefix_rows = data->sqlite_rows;
+    while ((status = sqlite3_step(data->suffix_query)) == SQLITE_ROW) {
+        if (++data->sqlite_rows > limit) {
+            too_many = true;
+            break;
+        }
+        if (match(length, password, data->suffix_query)) {
             found = true;
             break;
         }
+    }
+    STRENGTH_PROBE1(sqlite_suffix, data->sqlite_rows - prefix_rows);
     if (status != SQLITE_DONE && status != SQLITE_ROW) {
         code = error_sqlite(ctx, data, "error searching by password suffix");
-        goto fail;
+        goto done;
     }
     status = sqlite3_reset(data->suffix_query);
     if (status != SQLITE_OK) {
         code = error_sqlite(ctx, data, "error resetting suffix query");
-        goto fail;
+        goto done;
     }
     if (found)
         goto found;
+    if (too_many)
+        goto variants;
 
     /* No match.  Clean up and return success. */
-    explicit_bzero(prefix, length);
-    explicit_bzero(drowssap, length);
-    free(prefix);
-    free(drowssap);
-    return 0;
+    code = 0;
+    goto done;
+
+variants:
+    /* The ranges were too large, so check each variant instead. */
+    prefix_rows = data->sqlite_rows;
+    code = check_variants(ctx, data, password, length, &found);
+    STRENGTH_PROBE1(sqlite_variants, data->sqlite_rows - prefix_rows);
+    if (code != 0 || !found)
+        goto done;
 
 found:
     /* We found the password in the dictionary. */
     code = strength_error_dict(ctx, ERROR_DICT);
 
-fail:
-    if (prefix != NULL)
-        explicit_bzero(prefix, length);
-    explicit_bzero(drowssap, length);
-    free(prefix);
-    free(drowssap);
+done:
+    /*
+     * The bindings refer to the password and the buffer without copies, so
+     * clear them before the memory may be reused.
+     */
+    sqlite3_clear_bindings(data->prefix_query);
+    sqlite3_clear_bindings(data->suffix_query);
+    explicit_bzero(buffer, needed);
+    if (buffer != data->scratch)
+        free(buffer);
+    STRENGTH_PROBE2(sqlite_return, code, data->sqlite_rows);
     return code;
 }
 
@@ -394,12 +872,9 @@ fail:
 void
 strength_close_sqlite(krb5_context ctx UNUSED, krb5_pwqual_moddata data)
 {
-    if (data->prefix_query != NULL)
-        sqlite3_finalize(data->prefix_query);
-    if (data->suffix_query != NULL)
-        sqlite3_finalize(data->suffix_query);
-    if (data->sqlite != NULL)
-        sqlite3_close(data->sqlite);
+    close_database(data);
+    free(data->scratch);
+    free(data->sqlite_path);
 }
 
 #endif /* HAVE_SQLITE3 */
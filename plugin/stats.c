@@ -0,0 +1,201 @@
+/*
+ * Shared statistics for password checks.
+ *
+ * If stats_file is set in krb5.conf, each call to strength_check records, for
+ * each check run and for the call as a whole, the number of calls, the number
+ * of rejections, the total time, and a histogram of the time taken.  These
+ * counters live in a small file mapped shared into every process doing
+ * checks, so that they can be read and reset by krb5-strength-stats without
+ * any communication with kadmind.  The counters are updated with atomic
+ * operations and never locked.
+ *
+ * Nothing in this file uses Kerberos so that it can also be linked into
+ * krb5-strength-stats.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <plugin/internal.h>
+#include <util/macros.h>
+
+/*
+ * Atomically add to or clear a counter.  Relaxed ordering is enough since the
+ * counters are independent and only need to not lose updates.
+ */
+#if defined(__GNUC__)
+#    define COUNTER_ADD(c, n) __atomic_fetch_add(&(c), (n), __ATOMIC_RELAXED)
+#    define COUNTER_CLEAR(c)  __atomic_store_n(&(c), 0, __ATOMIC_RELAXED)
+#else
+#    define COUNTER_ADD(c, n) ((c) += (n))
+#    define COUNTER_CLEAR(c)  ((c) = 0)
+#endif
+
+
+/*
+ * Initialize the header of a newly-created statistics file.  The file has
+ * just been extended with ftruncate, so all the counters are already zero.
+ */
+static void
+stats_init(struct strength_stats *stats)
+{
+    stats->magic = STRENGTH_STATS_MAGIC;
+    stats->version = STRENGTH_STATS_VERSION;
+    stats->stages = STRENGTH_MAX_STAGES;
+    stats->buckets = STRENGTH_STATS_BUCKETS;
+    snprintf(stats->total.name, sizeof(stats->total.name), "total");
+}
+
+
+/*
+ * Map the statistics file at the given path.  If names is not NULL, create
+ * the file if it does not exist or is empty and set the names of the checks
+ * from names.  Otherwise, the file is opened and mapped read-only unless
+ * writable is true, so that it can be read by anyone who can read the file
+ * and cannot be modified by accident.  The file is locked while it is being
+ * set up so that two processes starting at the same time don't both
+ * initialize it.  Returns NULL and sets errno on failure, using EINVAL if the
+ * file exists and is not a statistics file of the right version.
+ */
+struct strength_stats *
+strength_stats_open(const char *path, const char *const *names, bool writable)
+{
+    struct strength_stats *stats = NULL;
+    struct stat st;
+    void *map;
+    size_t i;
+    int fd, oerrno, prot;
+
+    /* Open and lock the file. */
+    if (names != NULL)
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+    else if (writable)
+        fd = open(path, O_RDWR);
+    else
+        fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (flock(fd, (names == NULL) ? LOCK_SH : LOCK_EX) < 0)
+        goto fail;
+
+    /* Extend a new file to the right size, or check the size of an old one. */
+    if (fstat(fd, &st) < 0)
+        goto fail;
+    if (st.st_size == 0 && names != NULL) {
+        if (ftruncate(fd, sizeof(struct strength_stats)) < 0)
+            goto fail;
+    } else if (st.st_size != sizeof(struct strength_stats)) {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    /* Map the file and initialize or check the header. */
+    if (names != NULL || writable)
+        prot = PROT_READ | PROT_WRITE;
+    else
+        prot = PROT_READ;
+    map = mmap(NULL, sizeof(struct strength_stats), prot, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto fail;
+    stats = map;
+    if (stats->magic == 0 && names != NULL)
+        stats_init(stats);
+    if (stats->magic != STRENGTH_STATS_MAGIC
+        || stats->version != STRENGTH_STATS_VERSION
+        || stats->stages != STRENGTH_MAX_STAGES
+        || stats->buckets != STRENGTH_STATS_BUCKETS) {
+        munmap(map, sizeof(struct strength_stats));
+        stats = NULL;
+        errno = EINVAL;
+        goto fail;
+    }
+    if (names != NULL)
+        for (i = 0; i < STRENGTH_MAX_STAGES; i++)
+            snprintf(stats->stage[i].name, sizeof(stats->stage[i].name),
+                     "%s", names[i]);
+
+    /* The mapping stays valid after the file is closed. */
+    close(fd);
+    return stats;
+
+fail:
+    oerrno = errno;
+    close(fd);
+    errno = oerrno;
+    return NULL;
+}
+
+
+/*
+ * Record one call in a set of counters, given whether it rejected the
+ * password and how long it took in microseconds.
+ */
+void
+strength_stats_record(struct strength_stats_counters *counters, bool rejected,
+                      uint64_t usec)
+{
+    size_t bucket = 0;
+    uint64_t limit;
+
+    for (limit = usec; limit > 0 && bucket < STRENGTH_STATS_BUCKETS - 1;
+         limit >>= 1)
+        bucket++;
+    COUNTER_ADD(counters->calls, 1);
+    if (rejected)
+        COUNTER_ADD(counters->rejects, 1);
+    COUNTER_ADD(counters->usec, usec);
+    COUNTER_ADD(counters->latency[bucket], 1);
+}
+
+
+/*
+ * Clear one set of counters.
+ */
+static void
+reset_counters(struct strength_stats_counters *counters)
+{
+    size_t i;
+
+    COUNTER_CLEAR(counters->calls);
+    COUNTER_CLEAR(counters->rejects);
+    COUNTER_CLEAR(counters->usec);
+    for (i = 0; i < ARRAY_SIZE(counters->latency); i++)
+        COUNTER_CLEAR(counters->latency[i]);
+}
+
+
+/*
+ * Clear all of the counters.  Each counter is cleared atomically, but calls
+ * being recorded at the same time may be partly counted.
+ */
+void
+strength_stats_reset(struct strength_stats *stats)
+{
+    size_t i;
+
+    reset_counters(&stats->total);
+    for (i = 0; i < ARRAY_SIZE(stats->stage); i++)
+        reset_counters(&stats->stage[i]);
+}
+
+
+/*
+ * Unmap the statistics file.
+ */
+void
+strength_stats_close(struct strength_stats *stats)
+{
+    if (stats != NULL)
+        munmap(stats, sizeof(struct strength_stats));
+}
@@ -0,0 +1,117 @@
+/*
+ * Track changes to the files used by the module data.
+ *
+ * Most callers initialize the plugin once and keep the module data for as
+ * long as they run, restarting to pick up new dictionaries.  The Heimdal
+ * verifier, however, has no initialization hook and keeps module data between
+ * calls on its own, so it needs to know when that module data is stale.
+ * Provided here are functions to record the identity of each file that the
+ * module data depends on and to later check whether any of them has been
+ * modified or replaced.  A file that doesn't exist is recorded as missing, so
+ * creating it later also counts as a change.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/krb5.h>
+#include <portable/system.h>
+
+#include <sys/stat.h>
+
+#include <plugin/internal.h>
+
+
+/*
+ * Fill in the identity of the file at path, not including the path itself.
+ */
+static void
+identify(const char *path, struct strength_watched *file)
+{
+    struct stat st;
+
+    if (stat(path, &st) < 0) {
+        file->exists = false;
+        return;
+    }
+    file->exists = true;
+    file->device = st.st_dev;
+    file->inode = st.st_ino;
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+    file->mtime_nsec = st.st_mtim.tv_nsec;
+#else
+    file->mtime_nsec = 0;
+#endif
+}
+
+
+/*
+ * Record the current identity of a file that the module data depends on.
+ * Returns 0 on success or a Kerberos error code if memory allocation fails.
+ */
+krb5_error_code
+strength_watch(krb5_context ctx, krb5_pwqual_moddata data, const char *path)
+{
+    struct strength_watched *watched, *file;
+    size_t count = data->watched_count + 1;
+
+    watched = reallocarray(data->watched, count, sizeof(*watched));
+    if (watched == NULL)
+        return strength_error_system(ctx, "cannot allocate memory");
+    data->watched = watched;
+    file = &data->watched[data->watched_count];
+    file->path = strdup(path);
+    if (file->path == NULL)
+        return strength_error_system(ctx, "cannot allocate memory");
+    identify(path, file);
+    data->watched_count = count;
+    return 0;
+}
+
+
+/*
+ * Return true if any of the recorded files has been created, removed,
+ * replaced, or modified since it was recorded.
+ */
+bool
+strength_watch_changed(krb5_pwqual_moddata data)
+{
+    struct strength_watched current;
+    const struct strength_watched *file;
+    size_t i;
+
+    for (i = 0; i < data->watched_count; i++) {
+        file = &data->watched[i];
+        identify(file->path, &current);
+        if (current.exists != file->exists)
+            return true;
+        if (!file->exists)
+            continue;
+        if (current.device != file->device || current.inode != file->inode
+            || current.size != file->size || current.mtime != file->mtime
+            || current.mtime_nsec != file->mtime_nsec)
+            return true;
+    }
+    return false;
+}
+
+
+/*
+ * Free the list of recorded files.
+ */
+void
+strength_watch_free(krb5_pwqual_moddata data)
+{
+    size_t i;
+
+    for (i = 0; i < data->watched_count; i++)
+        free(data->watched[i].path);
+    free(data->watched);
+    data->watched = NULL;
+    data->watched_count = 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Test that accepting a password does not allocate memory.
+ *
+ * Once the plugin has been initialized, checking a password that passes all
+ * of the enabled checks should not touch the heap.  This test replaces the
+ * memory allocation functions with wrappers that count calls, initializes the
+ * checks directly with the CDB and SQLite dictionaries and all of the simple
+ * checks enabled, and then verifies that accepting a range of passwords does
+ * no allocations.  CrackLib is not included, since it opens its dictionary
+ * files with stdio on every check.  SQLite is only included if the SQLite
+ * library has lookaside memory, since otherwise SQLite itself allocates its
+ * cursors from the heap for every query.
+ *
+ * The wrappers call the underlying glibc allocator by its internal names, so
+ * this test only runs on systems using glibc.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/kadmin.h>
+#include <portable/krb5.h>
+#include <portable/system.h>
+
+#include <plugin/internal.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/kerberos.h>
+#include <tests/tap/process.h>
+#include <tests/tap/string.h>
+#include <util/macros.h>
+
+#ifndef __GLIBC__
+
+int
+main(void)
+{
+    skip_all("requires glibc");
+    return 0;
+}
+
+#else
+
+/* Passwords that should pass all of the configured checks. */
+static const char *const passwords[] = {
+    "Ab1!xyzw",
+    "known good Password 2",
+    "bitterbane123 but Longer!",
+    "0123456789 abcdefghij ABCDEFGHIJ !@#$%^&*() 0123456789 abcdefghij",
+};
+
+
+/* The underlying glibc allocator. */
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void __libc_free(void *);
+
+/* Whether to count allocations and the number counted. */
+static bool counting = false;
+static unsigned long allocations = 0;
+
+
+/*
+ * Replacements for the memory allocation functions that count calls while
+ * counting is enabled.  free is replaced as well so that everything goes
+ * through the same allocator.
+ */
+void *
+malloc(size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *p, size_t size)
+{
+    if (counting)
+        allocations++;
+    return __libc_realloc(p, size);
+}
+
+void
+free(void *p)
+{
+    __libc_free(p);
+}
+
+
+int
+main(void)
+{
+    char *path, *krb5_config, *tmpdir;
+    char *cdb = NULL;
+    char *sqlite = NULL;
+    const char *setup_argv[22];
+    size_t i, n;
+    krb5_context ctx;
+    krb5_pwqual_moddata data;
+    krb5_error_code code;
+
+    plan(2 + ARRAY_SIZE(passwords) * 2);
+
+    /*
+     * Generate a krb5.conf with all of the simple checks and whichever of the
+     * CDB and SQLite dictionaries we were built with.
+     */
+    tmpdir = test_tmpdir();
+    path = test_file_path("data/krb5.conf");
+    if (path == NULL)
+        bail("cannot find data/krb5.conf in the test suite");
+    setup_argv[0] = test_file_path("data/make-krb5-conf");
+    if (setup_argv[0] == NULL)
+        bail("cannot find data/make-krb5-conf in the test suite");
+    setup_argv[1] = path;
+    setup_argv[2] = tmpdir;
+    n = 3;
+    setup_argv[n++] = "minimum_length";
+    setup_argv[n++] = "8";
+    setup_argv[n++] = "minimum_different";
+    setup_argv[n++] = "6";
+    setup_argv[n++] = "require_ascii_printable";
+    setup_argv[n++] = "true";
+    setup_argv[n++] = "require_non_letter";
+    setup_argv[n++] = "true";
+    setup_argv[n++] = "require_classes";
+    setup_argv[n++] = "8-11:lower,upper,digit 12-19:2";
+#    ifdef HAVE_CDB
+    cdb = test_file_path("data/wordlist.cdb");
+    if (cdb == NULL)
+        bail("cannot find data/wordlist.cdb in the test suite");
+    setup_argv[n++] = "password_dictionary_cdb";
+    setup_argv[n++] = cdb;
+#    endif
+#    ifdef HAVE_SQLITE3
+    if (sqlite3_compileoption_used("OMIT_LOOKASIDE"))
+        diag("SQLite built without lookaside memory, not testing SQLite");
+    else {
+        sqlite = test_file_path("data/wordlist.sqlite");
+        if (sqlite == NULL)
+            bail("cannot find data/wordlist.sqlite in the test suite");
+        setup_argv[n++] = "password_dictionary_sqlite";
+        setup_argv[n++] = sqlite;
+    }
+#    endif
+    setup_argv[n] = NULL;
+    run_setup(setup_argv);
+    basprintf(&krb5_config, "KRB5_CONFIG=%s/krb5.conf", tmpdir);
+    putenv(krb5_config);
+
+    /* Initialize the checks. */
+    code = krb5_init_context(&ctx);
+    if (code != 0)
+        bail_krb5(ctx, code, "cannot initialize Kerberos context");
+    code = strength_init(ctx, NULL, &data);
+    if (code != 0)
+        bail_krb5(ctx, code, "cannot initialize strength checking");
+
+    /*
+     * Check each password once first so that any caches filled on first use,
+     * such as the SQLite page cache, are already populated.
+     */
+    for (i = 0; i < ARRAY_SIZE(passwords); i++) {
+        code = strength_check(ctx, data, "test@EXAMPLE.ORG", passwords[i]);
+        is_int(0, code, "accepted %s", passwords[i]);
+    }
+
+    /* Now check them again while counting allocations. */
+    for (i = 0; i < ARRAY_SIZE(passwords); i++) {
+        allocations = 0;
+        counting = true;
+        code = strength_check(ctx, data, "test@EXAMPLE.ORG", passwords[i]);
+        counting = false;
+        is_int(0, allocations, "no allocations for %s", passwords[i]);
+    }
+
+    /* A rejected password is still allowed to allocate for the message. */
+    code = strength_check(ctx, data, "test@EXAMPLE.ORG", "short");
+    is_int(KADM5_PASS_Q_TOOSHORT, code, "short password rejected");
+
+    /* Make sure the SQLite scratch space is still usable after a rejection. */
+    code = strength_check(ctx, data, "test@EXAMPLE.ORG", passwords[0]);
+    is_int(0, code, "accepted after a rejection");
+
+    /* Clean up. */
+    strength_close(ctx, data);
+    krb5_free_context(ctx);
+    test_file_path_free(sqlite);
+    test_file_path_free(cdb);
+    test_file_path_free((char *) setup_argv[0]);
+    test_file_path_free(path);
+    basprintf(&path, "%s/krb5.conf", tmpdir);
+    unlink(path);
+    free(path);
+    test_tmpdir_free(tmpdir);
+    putenv((char *) "KRB5_CONFIG=");
+    free(krb5_config);
+    return 0;
+}
+
+#endif /* __GLIBC__ */
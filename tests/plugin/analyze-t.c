@@ -0,0 +1,142 @@
+/*
+ * Test for the single-pass password analysis.
+ *
+ * Checks the summary produced by strength_analyze against a straightforward
+ * reference implementation using the ctype functions, for strings of every
+ * length up to several blocks.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <ctype.h>
+
+#include <plugin/internal.h>
+#include <tests/tap/basic.h>
+
+/* Longest string to test. */
+#define MAX_LENGTH 50
+
+
+/*
+ * Reference implementation of the password analysis, doing each check in a
+ * separate pass the way the checks originally did.
+ */
+static void
+reference_analyze(const char *password, struct password_info *info)
+{
+    const unsigned char *p;
+    const unsigned char *q;
+    bool seen;
+
+    memset(info, 0, sizeof(*info));
+    info->length = strlen(password);
+    info->printable = true;
+    info->alpha_space = true;
+    for (p = (const unsigned char *) password; *p != '\0'; p++) {
+        if (!isascii(*p) || !isprint(*p))
+            info->printable = false;
+        if (!isalpha(*p) && *p != ' ')
+            info->alpha_space = false;
+        if (islower(*p))
+            info->classes |= CLASS_LOWER;
+        else if (isupper(*p))
+            info->classes |= CLASS_UPPER;
+        else if (isdigit(*p))
+            info->classes |= CLASS_DIGIT;
+        else
+            info->classes |= CLASS_SYMBOL;
+        seen = false;
+        for (q = (const unsigned char *) password; q < p; q++)
+            if (*q == *p)
+                seen = true;
+        if (!seen)
+            info->unique++;
+    }
+    if (info->classes & CLASS_LOWER)
+        info->num_classes++;
+    if (info->classes & CLASS_UPPER)
+        info->num_classes++;
+    if (info->classes & CLASS_DIGIT)
+        info->num_classes++;
+    if (info->classes & CLASS_SYMBOL)
+        info->num_classes++;
+}
+
+
+/*
+ * Compare the analysis of a string with the reference.  Returns true if they
+ * agree and reports the difference otherwise.
+ */
+static bool
+check_string(const char *password)
+{
+    struct password_info info, want;
+
+    strength_analyze(password, &info);
+    reference_analyze(password, &want);
+    if (info.length == want.length && info.printable == want.printable
+        && info.alpha_space == want.alpha_space
+        && info.classes == want.classes
+        && info.num_classes == want.num_classes
+        && info.unique == want.unique)
+        return true;
+    diag("mismatch for string of length %lu", (unsigned long) want.length);
+    return false;
+}
+
+
+int
+main(void)
+{
+    struct password_info info;
+    char buffer[MAX_LENGTH + 1];
+    size_t length, offset, i;
+    bool all_ok = true;
+
+    plan(9);
+
+    /* A few specific cases. */
+    strength_analyze("", &info);
+    ok(info.length == 0 && info.printable && info.alpha_space
+           && info.num_classes == 0 && info.unique == 0,
+       "empty password");
+    strength_analyze("Password1!", &info);
+    is_int(10, info.length, "length");
+    is_int(CLASS_LOWER | CLASS_UPPER | CLASS_DIGIT | CLASS_SYMBOL,
+           info.classes, "classes");
+    is_int(4, info.num_classes, "number of classes");
+    is_int(9, info.unique, "unique characters");
+    ok(info.printable && !info.alpha_space, "flags");
+    strength_analyze("all letters and spaces in a long phrase", &info);
+    ok(info.alpha_space && info.classes == (CLASS_LOWER | CLASS_SYMBOL),
+       "long phrase");
+    strength_analyze("tab\tin password", &info);
+    ok(!info.printable, "control character");
+
+    /*
+     * Every length up to MAX_LENGTH, using strings of only lowercase letters,
+     * only printable ASCII, or any byte values, with each character appearing
+     * in each position within a block.
+     */
+    for (length = 0; length <= MAX_LENGTH; length++)
+        for (offset = 0; offset < 256; offset++) {
+            for (i = 0; i < length; i++) {
+                buffer[i] = (char) ((offset + i * 7) % 255 + 1);
+                if (offset % 3 == 0)
+                    buffer[i] = (char) ('a' + (offset + i) % 26);
+                else if (offset % 3 == 1)
+                    buffer[i] = (char) (' ' + (offset + i * 5) % 95);
+            }
+            buffer[length] = '\0';
+            if (!check_string(buffer))
+                all_ok = false;
+        }
+    ok(all_ok, "all generated strings match the reference");
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * Microbenchmark for the common prefix and suffix length functions.
+ *
+ * Simulates the comparisons done by the SQLite dictionary check for a large
+ * range of candidate words: a password is compared against many words that
+ * share its prefix and differ near the end, and the time per comparison is
+ * reported for each implementation supported on this system and for several
+ * password lengths.  This is not run as part of the test suite.  Build and
+ * run it with make bench.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <plugin/internal.h>
+#include <util/macros.h>
+
+/* Number of candidate words and number of passes over them. */
+#define WORDS  100000
+#define PASSES 20
+
+/* The implementations to time and their names. */
+static const struct {
+    enum strength_compare impl;
+    const char *name;
+} impls[] = {
+    {STRENGTH_COMPARE_SCALAR, "scalar"},
+    {STRENGTH_COMPARE_SSE2, "SSE2"},
+    {STRENGTH_COMPARE_AVX2, "AVX2"},
+};
+
+/* Password lengths to time. */
+static const size_t lengths[] = {8, 16, 32, 64, 128};
+
+
+/*
+ * Time the comparison of a password of the given length against the candidate
+ * words with the current implementation.  Returns the nanoseconds per word.
+ * The sum is accumulated so that the compiler can't discard the work.
+ */
+static double
+time_range(const char *password, size_t length, char **words,
+           size_t *total)
+{
+    uint64_t start, elapsed;
+    size_t i, pass;
+
+    start = strength_timestamp();
+    for (pass = 0; pass < PASSES; pass++)
+        for (i = 0; i < WORDS; i++) {
+            *total += strength_common_prefix(password, length, words[i], length);
+            *total += strength_common_suffix(password, length, words[i], length);
+        }
+    elapsed = strength_timestamp() - start;
+    return (double) elapsed * 1000.0 / ((double) WORDS * PASSES);
+}
+
+
+int
+main(void)
+{
+    char **words;
+    char *password;
+    size_t i, j, length, total = 0;
+
+    for (i = 0; i < ARRAY_SIZE(lengths); i++) {
+        length = lengths[i];
+
+        /*
+         * Build the password and a range of words that all share its first
+         * half and differ from it at some point in the second half.
+         */
+        password = malloc(length);
+        words = calloc(WORDS, sizeof(char *));
+        if (password == NULL || words == NULL) {
+            fprintf(stderr, "cannot allocate memory\n");
+            exit(1);
+        }
+        for (j = 0; j < length; j++)
+            password[j] = (char) ('a' + j % 26);
+        for (j = 0; j < WORDS; j++) {
+            words[j] = malloc(length);
+            if (words[j] == NULL) {
+                fprintf(stderr, "cannot allocate memory\n");
+                exit(1);
+            }
+            memcpy(words[j], password, length);
+            words[j][length / 2 + j % (length - length / 2)] = '!';
+        }
+
+        /* Time each supported implementation. */
+        printf("password length %lu:\n", (unsigned long) length);
+        for (j = 0; j < ARRAY_SIZE(impls); j++) {
+            if (!strength_compare_select(impls[j].impl))
+                continue;
+            printf("    %-8s %7.2f ns/word\n", impls[j].name,
+                   time_range(password, length, words, &total));
+        }
+
+        /* Clean up. */
+        for (j = 0; j < WORDS; j++)
+            free(words[j]);
+        free(words);
+        free(password);
+    }
+    return (total == 0) ? 1 : 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * Test for the common prefix and suffix length functions.
+ *
+ * Checks each implementation supported on this system against a simple
+ * reference implementation for all combinations of string lengths and
+ * positions of the first difference up to a size that covers several vector
+ * blocks plus a partial block.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <plugin/internal.h>
+#include <tests/tap/basic.h>
+
+/* Longest string to test exhaustively. */
+#define MAX_LENGTH 72
+
+/* Number of tests run for each implementation. */
+#define TESTS_PER_IMPL 9
+
+/* The implementations to test and their names. */
+static const struct {
+    enum strength_compare impl;
+    const char *name;
+} impls[] = {
+    {STRENGTH_COMPARE_SCALAR, "scalar"},
+    {STRENGTH_COMPARE_SSE2, "SSE2"},
+    {STRENGTH_COMPARE_AVX2, "AVX2"},
+};
+
+
+/* Reference implementation of the common prefix length. */
+static size_t
+reference_prefix(const char *a, size_t alen, const char *b, size_t blen)
+{
+    size_t i;
+
+    for (i = 0; i < alen && i < blen; i++)
+        if (a[i] != b[i])
+            break;
+    return i;
+}
+
+
+/* Reference implementation of the common suffix length. */
+static size_t
+reference_suffix(const char *a, size_t alen, const char *b, size_t blen)
+{
+    size_t i;
+
+    for (i = 0; i < alen && i < blen; i++)
+        if (a[alen - i - 1] != b[blen - i - 1])
+            break;
+    return i;
+}
+
+
+/*
+ * Return a newly allocated copy of the given data with exactly the given
+ * length and no nul terminator, so that valgrind will catch any read past the
+ * end of the string.
+ */
+static char *
+copy_exact(const char *data, size_t length)
+{
+    char *copy;
+
+    copy = bmalloc(length > 0 ? length : 1);
+    memcpy(copy, data, length);
+    return copy;
+}
+
+
+/*
+ * Compare one pair of strings with the current implementation against the
+ * reference implementation.  Returns true if both the prefix and suffix
+ * lengths agree and reports the failure otherwise.
+ */
+static bool
+check_pair(const char *a, size_t alen, const char *b, size_t blen)
+{
+    char *acopy, *bcopy;
+    size_t prefix, suffix, want_prefix, want_suffix;
+
+    acopy = copy_exact(a, alen);
+    bcopy = copy_exact(b, blen);
+    prefix = strength_common_prefix(acopy, alen, bcopy, blen);
+    suffix = strength_common_suffix(acopy, alen, bcopy, blen);
+    want_prefix = reference_prefix(a, alen, b, blen);
+    want_suffix = reference_suffix(a, alen, b, blen);
+    free(acopy);
+    free(bcopy);
+    if (prefix == want_prefix && suffix == want_suffix)
+        return true;
+    diag("lengths %lu and %lu: prefix %lu (want %lu), suffix %lu (want %lu)",
+         (unsigned long) alen, (unsigned long) blen, (unsigned long) prefix,
+         (unsigned long) want_prefix, (unsigned long) suffix,
+         (unsigned long) want_suffix);
+    return false;
+}
+
+
+/*
+ * Run the exhaustive tests against the current implementation.  The second
+ * string is a copy of a prefix or suffix of the first with one byte changed
+ * at each possible position, using a byte with the high bit set for some
+ * cases to catch sign problems.
+ */
+static void
+test_exhaustive(const char *name)
+{
+    char a[MAX_LENGTH];
+    char b[MAX_LENGTH];
+    size_t alen, blen, i;
+    bool prefix_ok = true;
+    bool suffix_ok = true;
+    bool high_ok = true;
+
+    for (i = 0; i < MAX_LENGTH; i++)
+        a[i] = (char) ('a' + i % 26);
+    for (alen = 0; alen <= MAX_LENGTH; alen++)
+        for (blen = 0; blen <= MAX_LENGTH; blen++) {
+            memcpy(b, a, blen);
+            if (!check_pair(a, alen, b, blen))
+                prefix_ok = false;
+            for (i = 0; i < blen; i++) {
+                b[i] = 'Z';
+                if (!check_pair(a, alen, b, blen))
+                    prefix_ok = false;
+                b[i] = (char) 0xe9;
+                if (!check_pair(a, alen, b, blen))
+                    high_ok = false;
+                b[i] = a[i];
+            }
+            if (blen > alen)
+                continue;
+            memcpy(b, a + alen - blen, blen);
+            for (i = 0; i < blen; i++) {
+                b[i] = 'Z';
+                if (!check_pair(a, alen, b, blen))
+                    suffix_ok = false;
+                b[i] = a[alen - blen + i];
+            }
+        }
+    ok(prefix_ok, "%s: differences from the start", name);
+    ok(suffix_ok, "%s: differences from the end", name);
+    ok(high_ok, "%s: bytes with the high bit set", name);
+}
+
+
+int
+main(void)
+{
+    size_t i;
+
+    plan(TESTS_PER_IMPL * ARRAY_SIZE(impls) + 2);
+
+    /* Without selecting an implementation, one is chosen on first use. */
+    is_int(5, strength_common_prefix("password", 8, "passw0rd", 8),
+           "default prefix");
+
+    /* Test each implementation that this system supports. */
+    for (i = 0; i < ARRAY_SIZE(impls); i++) {
+        const char *name = impls[i].name;
+
+        if (!strength_compare_select(impls[i].impl)) {
+            skip_block(TESTS_PER_IMPL, "%s not supported", name);
+            continue;
+        }
+        is_int(5, strength_common_prefix("password", 8, "passw0rd", 8),
+               "%s: prefix of password", name);
+        is_int(2, strength_common_suffix("password", 8, "passw0rd", 8),
+               "%s: suffix of password", name);
+        is_int(0, strength_common_prefix("", 0, "abc", 3),
+               "%s: prefix of empty string", name);
+        is_int(0, strength_common_suffix("abc", 3, "", 0),
+               "%s: suffix of empty string", name);
+        is_int(3, strength_common_suffix("aaaa", 4, "aaa", 3),
+               "%s: suffix of shorter string", name);
+        is_int(40,
+               strength_common_prefix(
+                   "0123456789012345678901234567890123456789", 40,
+                   "0123456789012345678901234567890123456789", 40),
+               "%s: prefix of identical long strings", name);
+        test_exhaustive(name);
+    }
+
+    /* Selecting the best implementation should always work. */
+    ok(strength_compare_select(STRENGTH_COMPARE_BEST), "select best");
+    return 0;
+}
@@ -139,16 +139,18 @@ is_password_test(const struct kadm5_pw_policy_verifier *verifier,
 int
 main(void)
 {
-    char *path, *krb5_config, *krb5_config_empty, *tmpdir;
+    char *path, *krb5_config, *krb5_config_empty, *tmpdir, *long_password;
     char *setup_argv[12];
+    struct password_test long_test = {0};
     size_t i, count;
     struct kadm5_pw_policy_verifier *verifier;
     void *handle;
 
     /*
      * Calculate how many tests we have.  There are five tests for the module
-     * metadata and two tests per password test.  We run the principal tests
-     * three times, once each with CrackLib, CDB, and SQLite.
+     * metadata and two tests per password test, plus one password test of a
+     * password too long for the plugin's stack buffer.  We run the principal
+     * tests three times, once each with CrackLib, CDB, and SQLite.
      */
     count = ARRAY_SIZE(cracklib_tests);
     count += 2 * ARRAY_SIZE(length_tests);
@@ -157,6 +159,7 @@ main(void)
     count += ARRAY_SIZE(classes_tests);
     count += ARRAY_SIZE(letter_tests);
     count += ARRAY_SIZE(principal_tests) * 3;
+    count += 1;
     plan(5 + count * 2);
 
     /* Start with the krb5.conf that contains no dictionary configuration. */
@@ -188,6 +191,19 @@ main(void)
     for (i = 0; i < ARRAY_SIZE(principal_tests); i++)
         is_password_test(verifier, &principal_tests[i]);
 
+    /*
+     * A password longer than the plugin's stack buffer is copied to the heap
+     * instead and still checked.
+     */
+    long_password = bcalloc_type(BUFSIZ * 2 + 1, char);
+    for (i = 0; i < BUFSIZ * 2; i++)
+        long_password[i] = (char) ('!' + i % ('~' - '!' + 1));
+    long_test.name = "password longer than BUFSIZ";
+    long_test.principal = "test@EXAMPLE.ORG";
+    long_test.password = long_password;
+    is_password_test(verifier, &long_test);
+    free(long_password);
+
 #    ifdef HAVE_CRACKLIB
 
     /* Add CrackLib tests. */
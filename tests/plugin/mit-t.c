@@ -2,7 +2,7 @@
  * Test for the MIT Kerberos shared module API.
  *
  * Written by Russ Allbery <eagle@eyrie.org>
- * Copyright 2017, 2020, 2023 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2017, 2020, 2023, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2010, 2013-2014
  *     The Board of Trustees of the Leland Stanford Junior University
  *
@@ -111,13 +111,67 @@ load_plugin(krb5_context ctx, void **handle)
 
 
 /*
- * Given a Kerberos context, the dispatch table, the module data, and a test
+ * Tests of settings for a kadmin password policy, which require passing the
+ * name of the policy to the plugin.  The admin policy requires a longer
+ * password.
+ */
+static const struct {
+    const char *policy;
+    struct password_test test;
+} policy_tests[] = {
+    {NULL,
+     {"no kadmin policy", "test@EXAMPLE.ORG", "mYv4lid-pw", 0, NULL, false}},
+    {"admin",
+     {"admin kadmin policy", "test@EXAMPLE.ORG", "mYv4lid-pw",
+      KADM5_PASS_Q_TOOSHORT, "Password is too short", false}},
+    {"default",
+     {"kadmin policy without settings", "test@EXAMPLE.ORG", "mYv4lid-pw", 0,
+      NULL, false}},
+};
+
+
+/*
+ * Tests of language dictionaries, which require passing the languages of the
+ * user to the plugin.  Only a German dictionary is configured.
+ */
+static const char *const german[] = {"de-DE", NULL};
+static const char *const french[] = {"fr", NULL};
+static const struct {
+    const char *const *languages;
+    struct password_test test;
+} language_tests[] = {
+    {german,
+     {"in language dictionary", "test@EXAMPLE.ORG", "bitterbane1",
+      KADM5_PASS_Q_DICT, "Password found in list of common passwords",
+      false}},
+    {NULL,
+     {"no languages", "test@EXAMPLE.ORG", "bitterbane1", 0, NULL, false}},
+    {french,
+     {"other language", "test@EXAMPLE.ORG", "bitterbane1", 0, NULL, false}},
+};
+
+
+/*
+ * Tests of reloading the configuration.  The first is run before krb5.conf is
+ * changed to require longer passwords and the second after the new
+ * configuration has been loaded.
+ */
+static const struct password_test reload_tests[] = {
+    {"before reload", "test@EXAMPLE.ORG", "mYv4lid-pw", 0, NULL, false},
+    {"after reload", "test@EXAMPLE.ORG", "mYv4lid-pw", KADM5_PASS_Q_TOOSHORT,
+     "Password is too short", false},
+};
+
+/*
+ * Given a Kerberos context, the dispatch table, the module data, the name of
+ * the kadmin policy or NULL, the languages of the user or NULL, and a test
  * case, call out to the password strength checking module and check the
  * results.
  */
 static void
-is_password_test(krb5_context ctx, const krb5_pwqual_vtable vtable,
-                 krb5_pwqual_moddata data, const struct password_test *test)
+is_policy_test(krb5_context ctx, const krb5_pwqual_vtable vtable,
+               krb5_pwqual_moddata data, const char *policy,
+               const char *const *languages, const struct password_test *test)
 {
     krb5_principal princ;
     krb5_error_code code;
@@ -129,7 +183,8 @@ is_password_test(krb5_context ctx, const krb5_pwqual_vtable vtable,
         bail_krb5(ctx, code, "cannot parse principal %s", test->principal);
 
     /* Call the verifier. */
-    code = vtable->check(ctx, data, test->password, NULL, princ, NULL);
+    code = vtable->check(ctx, data, test->password, policy, princ,
+                         (const char **) languages);
 
     /* Check the results against the test data. */
     is_int(test->code, code, "%s (status)", test->name);
@@ -146,10 +201,51 @@ is_password_test(krb5_context ctx, const krb5_pwqual_vtable vtable,
 }
 
 
+/*
+ * The same, but for a principal with no kadmin policy.
+ */
+static void
+is_password_test(krb5_context ctx, const krb5_pwqual_vtable vtable,
+                 krb5_pwqual_moddata data, const struct password_test *test)
+{
+    is_policy_test(ctx, vtable, data, NULL, NULL, test);
+}
+
+
+/*
+ * Wait for the plugin to pick up a configuration change in the background.
+ * Given a Kerberos context, the dispatch table, the module data, and a test
+ * whose password should now be rejected, repeat the check until the password
+ * is rejected, giving up after ten seconds.
+ */
+static void
+wait_for_reload(krb5_context ctx, krb5_pwqual_vtable vtable,
+                krb5_pwqual_moddata data, const struct password_test *test)
+{
+    krb5_principal princ;
+    krb5_error_code code;
+    size_t i;
+
+    code = krb5_parse_name(ctx, test->principal, &princ);
+    if (code != 0)
+        bail_krb5(ctx, code, "cannot parse principal %s", test->principal);
+    for (i = 0; i < 100; i++) {
+        code = vtable->check(ctx, data, test->password, NULL, princ, NULL);
+        if (code != 0)
+            break;
+        usleep(100000);
+    }
+    krb5_free_principal(ctx, princ);
+}
+
+
 int
 main(void)
 {
     char *path, *dictionary, *krb5_config, *krb5_config_empty, *tmpdir;
+#    ifdef HAVE_CDB
+    char *language;
+#    endif
     char *setup_argv[12];
     const char *build;
     size_t i, count;
@@ -161,7 +257,7 @@ main(void)
 
     /*
      * Calculate how many tests we have.  There are two tests for the module
-     * metadata, seven more tests for initializing the plugin, and two tests
+     * metadata, twelve more tests for initializing the plugin, and two tests
      * per password test.
      *
      * We run all the CrackLib tests twice, once with an explicit dictionary
@@ -175,7 +271,10 @@ main(void)
     count += ARRAY_SIZE(classes_tests);
     count += ARRAY_SIZE(letter_tests);
     count += 3 * ARRAY_SIZE(principal_tests);
-    plan(2 + 8 + count * 2);
+    count += ARRAY_SIZE(policy_tests);
+    count += ARRAY_SIZE(language_tests);
+    count += ARRAY_SIZE(reload_tests);
+    plan(2 + 12 + count * 2);
 
     /* Start with the krb5.conf that contains no dictionary configuration. */
     path = test_file_path("data/krb5.conf");
@@ -376,6 +475,58 @@ main(void)
         is_password_test(ctx, vtable, data, &length_tests[i]);
     vtable->close(ctx, data);
 
+    /* Add a kadmin policy that requires longer passwords. */
+    setup_argv[3] = (char *) "minimum_length";
+    setup_argv[4] = (char *) "8";
+    setup_argv[5] = (char *) "policies";
+    setup_argv[6] = (char *) "admin";
+    setup_argv[7] = (char *) "admin";
+    setup_argv[8] = (char *) "{\n            minimum_length = 16\n        }";
+    setup_argv[9] = NULL;
+    run_setup((const char **) setup_argv);
+
+    /* Obtain a new Kerberos context with that krb5.conf file. */
+    krb5_free_context(ctx);
+    code = krb5_init_context(&ctx);
+    if (code != 0)
+        bail_krb5(ctx, code, "cannot initialize Kerberos context");
+
+    /* Run the kadmin policy tests. */
+    code = vtable->open(ctx, NULL, &data);
+    is_int(0, code, "Plugin initialization (kadmin policies)");
+    if (code != 0)
+        bail_krb5(ctx, code, "plugin initialization failure");
+    for (i = 0; i < ARRAY_SIZE(policy_tests); i++)
+        is_policy_test(ctx, vtable, data, policy_tests[i].policy, NULL,
+                       &policy_tests[i].test);
+    vtable->close(ctx, data);
+
+    /* Check for configuration changes on every password check. */
+    setup_argv[3] = (char *) "minimum_length";
+    setup_argv[4] = (char *) "8";
+    setup_argv[5] = (char *) "reload_interval";
+    setup_argv[6] = (char *) "0";
+    setup_argv[7] = NULL;
+    run_setup((const char **) setup_argv);
+
+    /* Obtain a new Kerberos context with that krb5.conf file. */
+    krb5_free_context(ctx);
+    code = krb5_init_context(&ctx);
+    if (code != 0)
+        bail_krb5(ctx, code, "cannot initialize Kerberos context");
+
+    /* Check a password, require longer passwords, and check it again. */
+    code = vtable->open(ctx, NULL, &data);
+    is_int(0, code, "Plugin initialization (reload)");
+    if (code != 0)
+        bail_krb5(ctx, code, "plugin initialization failure");
+    is_password_test(ctx, vtable, data, &reload_tests[0]);
+    setup_argv[4] = (char *) "12";
+    run_setup((const char **) setup_argv);
+    wait_for_reload(ctx, vtable, data, &reload_tests[1]);
+    is_password_test(ctx, vtable, data, &reload_tests[1]);
+    vtable->close(ctx, data);
+
 #    ifdef HAVE_CDB
 
     /* If built with CDB, set up krb5.conf to use a CDB dictionary instead. */
@@ -405,11 +556,48 @@ main(void)
         is_password_test(ctx, vtable, data, &principal_tests[i]);
     vtable->close(ctx, data);
 
+    /* Use the same dictionary as a German language dictionary instead. */
+    basprintf(&language, "de:%s", dictionary);
+    setup_argv[3] = (char *) "language_dictionary_cdb";
+    setup_argv[4] = language;
+    setup_argv[5] = NULL;
+    run_setup((const char **) setup_argv);
+    free(language);
+
+    /* Obtain a new Kerberos context with that krb5.conf file. */
+    krb5_free_context(ctx);
+    code = krb5_init_context(&ctx);
+    if (code != 0)
+        bail_krb5(ctx, code, "cannot initialize Kerberos context");
+
+    /* Run the language dictionary tests. */
+    code = vtable->open(ctx, NULL, &data);
+    is_int(0, code, "Plugin initialization (language dictionary)");
+    if (code != 0)
+        bail("cannot continue after plugin initialization failure");
+    for (i = 0; i < ARRAY_SIZE(language_tests); i++)
+        is_policy_test(ctx, vtable, data, NULL, language_tests[i].languages,
+                       &language_tests[i].test);
+    vtable->close(ctx, data);
+
+    /* A language dictionary that can't be read is an error at startup. */
+    setup_argv[4] = (char *) "de:/nonexistent/german.cdb";
+    run_setup((const char **) setup_argv);
+    krb5_free_context(ctx);
+    code = krb5_init_context(&ctx);
+    if (code != 0)
+        bail_krb5(ctx, code, "cannot initialize Kerberos context");
+    code = vtable->open(ctx, NULL, &data);
+    is_int(ENOENT, code, "Plugin initialization (missing language)");
+    if (code == 0)
+        vtable->close(ctx, data);
+
 #    else /* !HAVE_CDB */
 
-    /* Otherwise, mark the CDB tests as skipped. */
+    /* Otherwise, mark the CDB and language dictionary tests as skipped. */
     count = ARRAY_SIZE(cdb_tests) + ARRAY_SIZE(principal_tests);
-    skip_block(count * 2 + 1, "not built with CDB support");
+    count += ARRAY_SIZE(language_tests);
+    skip_block(count * 2 + 3, "not built with CDB support");
 
 #    endif /* !HAVE_CDB */
 
@@ -0,0 +1,102 @@
+/*
+ * Test for tracking changes to the files used by the module data.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/krb5.h>
+#include <portable/system.h>
+
+#include <plugin/internal.h>
+#include <tests/tap/basic.h>
+#include <tests/tap/string.h>
+
+
+/*
+ * Write the given contents to a file, replacing any existing contents.
+ */
+static void
+write_file(const char *path, const char *contents)
+{
+    FILE *file;
+
+    file = fopen(path, "w");
+    if (file == NULL)
+        sysbail("cannot create %s", path);
+    if (fputs(contents, file) == EOF)
+        sysbail("cannot write to %s", path);
+    if (fclose(file) == EOF)
+        sysbail("cannot flush %s", path);
+}
+
+
+int
+main(void)
+{
+    char *tmpdir, *path, *missing, *renamed;
+    krb5_context ctx;
+    krb5_error_code code;
+    krb5_pwqual_moddata data;
+
+    plan(11);
+
+    /* Set up a Kerberos context for error reporting and empty module data. */
+    code = krb5_init_context(&ctx);
+    if (code != 0)
+        bail("cannot initialize Kerberos context");
+    data = bcalloc(1, sizeof(*data));
+    tmpdir = test_tmpdir();
+    basprintf(&path, "%s/watched", tmpdir);
+    basprintf(&missing, "%s/missing", tmpdir);
+    basprintf(&renamed, "%s/renamed", tmpdir);
+    write_file(path, "first\n");
+    unlink(missing);
+
+    /* Watch an existing file and a missing file. */
+    is_int(0, strength_watch(ctx, data, path), "Watch existing file");
+    is_int(0, strength_watch(ctx, data, missing), "Watch missing file");
+    is_int(2, data->watched_count, "...both recorded");
+    ok(!strength_watch_changed(data), "Nothing changed");
+
+    /* Changing the contents of the file is noticed. */
+    write_file(path, "second contents\n");
+    ok(strength_watch_changed(data), "Modified file noticed");
+
+    /* Replacing the file by renaming another over it is noticed. */
+    strength_watch_free(data);
+    is_int(0, data->watched_count, "Records freed");
+    strength_watch(ctx, data, path);
+    write_file(renamed, "second contents\n");
+    if (rename(renamed, path) < 0)
+        sysbail("cannot rename %s to %s", renamed, path);
+    ok(strength_watch_changed(data), "Replaced file noticed");
+
+    /* Removing a file is noticed. */
+    strength_watch_free(data);
+    strength_watch(ctx, data, path);
+    ok(!strength_watch_changed(data), "Nothing changed after rewatching");
+    unlink(path);
+    ok(strength_watch_changed(data), "Removed file noticed");
+
+    /* Creating a file that was missing is noticed. */
+    strength_watch_free(data);
+    strength_watch(ctx, data, missing);
+    ok(!strength_watch_changed(data), "Missing file still missing");
+    write_file(missing, "created\n");
+    ok(strength_watch_changed(data), "Created file noticed");
+
+    /* Clean up. */
+    strength_watch_free(data);
+    free(data);
+    unlink(missing);
+    free(path);
+    free(missing);
+    free(renamed);
+    test_tmpdir_free(tmpdir);
+    krb5_free_context(ctx);
+    return 0;
+}
@@ -0,0 +1,1388 @@
+/*
+ * Password history via Heimdal external strength checking, compiled.
+ *
+ * This is a compiled equivalent of the heimdal-history Perl program.  It reads
+ * a password change in the Heimdal external-check format, checks the strength
+ * of the password in-process with the same checks as heimdal-strength, and
+ * then checks and updates per-principal password history.  Avoiding the Perl
+ * interpreter, its modules, and a second process for heimdal-strength makes
+ * each password change much cheaper.
+ *
+ * History is stored in the same Berkeley DB file and in the same format as
+ * heimdal-history, so the two programs can be used interchangeably.  The key
+ * is the principal and the value is a JSON array of objects with timestamp
+ * and hash keys, newest first.  The hash is a PBKDF2 hash in the LDAP-style
+ * format of the Perl Crypt::PBKDF2 module:
+ *
+ *     {X-PBKDF2}HMACSHA2+256:<iterations>:<salt>:<hash>
+ *
+ * where the iterations are a base64-encoded 32-bit big-endian number with
+ * the padding removed and the salt and hash are base64-encoded.
+ *
+ * Each hash in history takes as long to check as hashing a new password, so
+ * the hashes are checked in parallel by one thread per CPU, and the checks
+ * still running stop as soon as one hash matches.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/krb5.h>
+#include <portable/system.h>
+
+#include <ctype.h>
+#include <db.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <sys/file.h>
+#include <sys/wait.h>
+#include <syslog.h>
+#include <time.h>
+
+#include <plugin/internal.h>
+#include <util/macros.h>
+#include <util/messages-krb5.h>
+#include <util/messages.h>
+#include <util/xmalloc.h>
+
+/*
+ * The number of PBKDF2 iterations to use when hashing passwords.  This number
+ * should be chosen so as to force the hash operation to take approximately
+ * 0.1 seconds on current hardware.  Use -b to find a good value.
+ */
+#define HASH_ITERATIONS 45144
+
+/* Path to the history database. */
+#define HISTORY_PATH "/var/lib/heimdal-history/history.db"
+
+/* User and group used for all password history lookups and writes. */
+#define HISTORY_USER  "_history"
+#define HISTORY_GROUP "_history"
+
+/*
+ * User and group used for the password strength checks, which run in a
+ * separate process so that they cannot modify the history database.
+ */
+#define STRENGTH_USER  "nobody"
+#define STRENGTH_GROUP "nogroup"
+
+/* Path to the database of the lengths of accepted passwords. */
+#define LENGTH_STATS_PATH "/var/lib/heimdal-history/lengths.db"
+
+/* The message returned if the password was found in history. */
+#define REJECT_MESSAGE "Password was previously used"
+
+/* The syslog identity, the same as heimdal-history for log processing. */
+#define SYSLOG_IDENT "heimdal-history"
+
+/*
+ * Parameters of new hashes.  Crypt::PBKDF2 uses four bytes of salt by
+ * default, but reads hashes with any length of salt, so use more.
+ */
+#define HASH_PREFIX    "{X-PBKDF2}"
+#define HASH_ALGORITHM "HMACSHA2+256"
+#define HASH_LENGTH    32
+#define SALT_LENGTH    16
+
+/* The largest salt or hash accepted when reading a hash from history. */
+#define MAX_HASH_DATA 256
+
+/* The largest block size of any digest usable with HMAC. */
+#define MAX_BLOCK_SIZE 128
+
+/* The number of PBKDF2 iterations between checks for cancellation. */
+#define CANCEL_INTERVAL 1024
+
+/* The deepest nesting of JSON arrays and objects accepted in history. */
+#define MAX_JSON_DEPTH 32
+
+/* Usage message. */
+static const char usage_message[] = "\
+Usage: heimdal-history-native [-chq] [-b <target>] [-d <database>]\n\
+                              [-S <length-db>] [<principal>]\n\
+\n\
+Options:\n\
+    -b <target>   Find hash iterations taking this many seconds and exit\n\
+    -c            Check history without updating the databases\n\
+    -d <database> Path to the history database\n\
+    -h            Print this usage message and exit\n\
+    -q            Suppress logging to syslog\n\
+    -S <path>     Path to the database of password length statistics\n";
+
+/* A PBKDF2 hash from history, decoded. */
+struct pbkdf2_hash {
+    const EVP_MD *digest;               /* Digest used with HMAC */
+    unsigned long iterations;           /* Number of iterations */
+    unsigned char salt[MAX_HASH_DATA];  /* Salt */
+    size_t salt_length;                 /* Length of the salt */
+    unsigned char hash[MAX_HASH_DATA];  /* Expected output */
+    size_t hash_length;                 /* Length of the output */
+};
+
+/*
+ * The state shared by the threads checking a password against the hashes in
+ * history.  Each thread takes the next unchecked hash until one matches or
+ * there are none left.
+ */
+struct history_check {
+    const char *principal;  /* Principal, for logging */
+    const char *password;   /* Password to check */
+    struct vector *hashes;  /* Hashes from history */
+    size_t next;            /* Index of the next hash to check */
+    bool found;             /* Whether a hash has matched */
+    pthread_mutex_t lock;   /* Protects next and found */
+};
+
+/* A position in JSON text being parsed. */
+struct json {
+    const char *p;   /* Next character to parse */
+    const char *end; /* End of the text */
+};
+
+/* An open Berkeley DB database and the lock file protecting it. */
+struct database {
+    DB *db;      /* Open database */
+    int lock_fd; /* Locked file descriptor of the lock file */
+};
+
+/* Whether to log to syslog, cleared by -q. */
+static bool use_syslog = true;
+
+
+/*
+ * Print usage information and exit with the given status.
+ */
+__attribute__((__noreturn__)) static void
+usage(int status)
+{
+    fprintf((status == 0) ? stdout : stderr, "%s", usage_message);
+    exit(status);
+}
+
+
+/*
+ * Change the real and effective UID and GID to those of the given user and
+ * group and clear the supplemental groups.  Does nothing if not running as
+ * root.
+ */
+static void
+drop_privileges(const char *user, const char *group)
+{
+    struct passwd *pw;
+    struct group *gr;
+
+    if (geteuid() != 0 && getuid() != 0)
+        return;
+    pw = getpwnam(user);
+    if (pw == NULL)
+        die("cannot get UID for %s", user);
+    gr = getgrnam(group);
+    if (gr == NULL)
+        die("cannot get GID for %s", group);
+    if (setgroups(1, &gr->gr_gid) < 0)
+        sysdie("cannot set supplemental groups to %lu",
+               (unsigned long) gr->gr_gid);
+    if (setgid(gr->gr_gid) < 0)
+        sysdie("cannot setgid to %lu", (unsigned long) gr->gr_gid);
+    if (setuid(pw->pw_uid) < 0)
+        sysdie("cannot setuid to %lu", (unsigned long) pw->pw_uid);
+    if (geteuid() == 0 || getuid() == 0)
+        die("failed to drop permissions");
+}
+
+
+/*
+ * Append a key and value to a log message in newly allocated memory, which
+ * is freed and replaced.  Values containing a space or a double quote are
+ * quoted with double quotes, and any double quotes in them are doubled.
+ */
+static void
+log_append(char **message, const char *key, const char *value)
+{
+    char *quoted, *p, *result;
+    const char *q;
+    bool quote;
+
+    quote = (strpbrk(value, " \"") != NULL);
+    quoted = xmalloc(strlen(value) * 2 + 3);
+    p = quoted;
+    if (quote)
+        *p++ = '"';
+    for (q = value; *q != '\0'; q++) {
+        if (*q == '"')
+            *p++ = '"';
+        *p++ = *q;
+    }
+    if (quote)
+        *p++ = '"';
+    *p = '\0';
+    if (*message == NULL)
+        xasprintf(&result, "%s=%s", key, quoted);
+    else
+        xasprintf(&result, "%s %s=%s", *message, key, quoted);
+    free(quoted);
+    free(*message);
+    *message = result;
+}
+
+
+/*
+ * Log a non-fatal error encountered while checking or storing password
+ * history, such as a corrupt history entry, in the same format as
+ * heimdal-history.  The password is still accepted.
+ */
+static void
+log_error(const char *principal, const char *error)
+{
+    char *message = NULL;
+
+    if (!use_syslog)
+        return;
+    log_append(&message, "action", "check");
+    log_append(&message, "principal", principal);
+    log_append(&message, "error", error);
+    syslog(LOG_WARNING, "%s", message);
+    free(message);
+}
+
+
+/*
+ * Log the result of a password check, either accepted or rejected, in the
+ * same format as heimdal-history.  reason should be NULL for an accepted
+ * password.
+ */
+static void
+log_result(const char *principal, const char *result, const char *reason)
+{
+    char *message = NULL;
+
+    if (!use_syslog)
+        return;
+    log_append(&message, "action", "check");
+    log_append(&message, "principal", principal);
+    log_append(&message, "result", result);
+    if (reason != NULL)
+        log_append(&message, "reason", reason);
+    syslog(LOG_INFO, "%s", message);
+    free(message);
+}
+
+
+/*
+ * Return the base64 encoding of data, with padding, in newly allocated
+ * memory.
+ */
+static char *
+base64_encode(const unsigned char *data, size_t length)
+{
+    char *encoded;
+
+    encoded = xmalloc((length + 2) / 3 * 4 + 1);
+    EVP_EncodeBlock((unsigned char *) encoded, data, (int) length);
+    return encoded;
+}
+
+
+/*
+ * Decode the base64 string of the given length into output, which can hold
+ * size bytes, and store the decoded length in length.  The padding is
+ * optional, since Crypt::PBKDF2 removes it from the iteration count.
+ * Returns false if the string is not valid base64 or is too long.
+ */
+static bool
+base64_decode(const char *string, size_t length, unsigned char *output,
+              size_t size, size_t *decoded)
+{
+    static const char alphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    unsigned long bits = 0;
+    unsigned int count = 0;
+    const char *p;
+    size_t i;
+
+    while (length > 0 && string[length - 1] == '=')
+        length--;
+    if (length % 4 == 1)
+        return false;
+    *decoded = 0;
+    for (i = 0; i < length; i++) {
+        p = memchr(alphabet, string[i], sizeof(alphabet) - 1);
+        if (p == NULL || string[i] == '\0')
+            return false;
+        bits = (bits << 6) | (unsigned long) (p - alphabet);
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            if (*decoded >= size)
+                return false;
+            output[(*decoded)++] = (unsigned char) ((bits >> count) & 0xff);
+        }
+    }
+    return true;
+}
+
+
+/*
+ * Parse a hash in the LDAP-style format of Crypt::PBKDF2 into a struct
+ * pbkdf2_hash.  Returns false and sets error to a static string describing
+ * the problem if the hash is not in that format or uses an unsupported
+ * digest.
+ */
+static bool
+parse_hash(const char *string, struct pbkdf2_hash *hash, const char **error)
+{
+    const char *algorithm, *fields[3];
+    unsigned char count[4];
+    size_t algorithm_length, length, i;
+
+    *error = "unrecognized hash format";
+    if (strncasecmp(string, HASH_PREFIX, strlen(HASH_PREFIX)) != 0)
+        return false;
+    algorithm = string + strlen(HASH_PREFIX);
+    fields[0] = strchr(algorithm, ':');
+    if (fields[0] == NULL)
+        return false;
+    algorithm_length = (size_t) (fields[0] - algorithm);
+    for (i = 1; i < ARRAY_SIZE(fields); i++) {
+        fields[i] = strchr(fields[i - 1] + 1, ':');
+        if (fields[i] == NULL)
+            return false;
+    }
+
+    /* Map the Crypt::PBKDF2 hasher name to a digest. */
+    if (algorithm_length == strlen("HMACSHA1")
+        && strncasecmp(algorithm, "HMACSHA1", algorithm_length) == 0)
+        hash->digest = EVP_sha1();
+    else if (algorithm_length == strlen("HMACSHA2")
+             && strncasecmp(algorithm, "HMACSHA2", algorithm_length) == 0)
+        hash->digest = EVP_sha256();
+    else if (strncasecmp(algorithm, "HMACSHA2+", strlen("HMACSHA2+")) == 0) {
+        length = algorithm_length - strlen("HMACSHA2+");
+        algorithm += strlen("HMACSHA2+");
+        if (length == 3 && strncmp(algorithm, "224", length) == 0)
+            hash->digest = EVP_sha224();
+        else if (length == 3 && strncmp(algorithm, "256", length) == 0)
+            hash->digest = EVP_sha256();
+        else if (length == 3 && strncmp(algorithm, "384", length) == 0)
+            hash->digest = EVP_sha384();
+        else if (length == 3 && strncmp(algorithm, "512", length) == 0)
+            hash->digest = EVP_sha512();
+        else {
+            *error = "unsupported hash algorithm";
+            return false;
+        }
+    } else {
+        *error = "unsupported hash algorithm";
+        return false;
+    }
+
+    /* Decode the iteration count, salt, and hash. */
+    *error = "invalid hash encoding";
+    length = (size_t) (fields[1] - fields[0] - 1);
+    if (!base64_decode(fields[0] + 1, length, count, sizeof(count), &length))
+        return false;
+    if (length != sizeof(count))
+        return false;
+    hash->iterations = ((unsigned long) count[0] << 24)
+                       | ((unsigned long) count[1] << 16)
+                       | ((unsigned long) count[2] << 8) | count[3];
+    length = (size_t) (fields[2] - fields[1] - 1);
+    if (!base64_decode(fields[1] + 1, length, hash->salt, sizeof(hash->salt),
+                       &hash->salt_length))
+        return false;
+    if (!base64_decode(fields[2] + 1, strlen(fields[2] + 1), hash->hash,
+                       sizeof(hash->hash), &hash->hash_length))
+        return false;
+    if (hash->iterations == 0 || hash->iterations > INT_MAX
+        || hash->hash_length == 0) {
+        *error = "invalid hash parameters";
+        return false;
+    }
+    return true;
+}
+
+
+/*
+ * Compute an HMAC from the digest states after the inner and outer padded
+ * keys, over data followed by extra if it is not NULL, and store the result
+ * in output, which may be the same as data.  ctx is used as scratch space.
+ * Returns false on failure.
+ */
+static bool
+hmac(EVP_MD_CTX *ctx, const EVP_MD_CTX *inner, const EVP_MD_CTX *outer,
+     const unsigned char *data, size_t length, const unsigned char *extra,
+     size_t extra_length, unsigned char *output)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int size;
+
+    if (EVP_MD_CTX_copy_ex(ctx, inner) != 1
+        || EVP_DigestUpdate(ctx, data, length) != 1)
+        return false;
+    if (extra != NULL && EVP_DigestUpdate(ctx, extra, extra_length) != 1)
+        return false;
+    if (EVP_DigestFinal_ex(ctx, digest, &size) != 1)
+        return false;
+    if (EVP_MD_CTX_copy_ex(ctx, outer) != 1
+        || EVP_DigestUpdate(ctx, digest, size) != 1
+        || EVP_DigestFinal_ex(ctx, output, &size) != 1)
+        return false;
+    return true;
+}
+
+
+/*
+ * Return whether another thread has already found the password in history,
+ * so that checks of the remaining hashes can stop.
+ */
+static bool
+check_done(struct history_check *check)
+{
+    bool found;
+
+    pthread_mutex_lock(&check->lock);
+    found = check->found;
+    pthread_mutex_unlock(&check->lock);
+    return found;
+}
+
+
+/*
+ * Compute PBKDF2 of the password with the digest, salt, and iterations of a
+ * parsed hash, storing as many bytes as the hash in output.  This is done
+ * here rather than with PKCS5_PBKDF2_HMAC so that it can stop part way
+ * through.  The HMAC key is the same for every iteration, so the digest
+ * states after the padded keys are computed once and copied.  Returns false
+ * without finishing if another thread finds the password first.
+ */
+static bool
+pbkdf2(const struct pbkdf2_hash *hash, const char *password,
+       struct history_check *check, unsigned char *output)
+{
+    EVP_MD_CTX *ctx, *inner, *outer;
+    unsigned char key[MAX_BLOCK_SIZE], pad[MAX_BLOCK_SIZE];
+    unsigned char u[EVP_MAX_MD_SIZE], t[EVP_MAX_MD_SIZE], count[4];
+    size_t block_size, size, length, offset, i;
+    unsigned long block, j;
+    unsigned int key_length;
+    bool okay = false, cancelled = false;
+
+    ctx = EVP_MD_CTX_new();
+    inner = EVP_MD_CTX_new();
+    outer = EVP_MD_CTX_new();
+    if (ctx == NULL || inner == NULL || outer == NULL)
+        goto done;
+    block_size = (size_t) EVP_MD_block_size(hash->digest);
+    size = (size_t) EVP_MD_size(hash->digest);
+    if (block_size > sizeof(key))
+        goto done;
+
+    /* Set up the HMAC key and the digest states after the padded keys. */
+    memset(key, 0, sizeof(key));
+    length = strlen(password);
+    if (length > block_size) {
+        if (EVP_Digest(password, length, key, &key_length, hash->digest, NULL)
+            != 1)
+            goto done;
+    } else
+        memcpy(key, password, length);
+    for (i = 0; i < block_size; i++)
+        pad[i] = key[i] ^ 0x36;
+    if (EVP_DigestInit_ex(inner, hash->digest, NULL) != 1
+        || EVP_DigestUpdate(inner, pad, block_size) != 1)
+        goto done;
+    for (i = 0; i < block_size; i++)
+        pad[i] = key[i] ^ 0x5c;
+    if (EVP_DigestInit_ex(outer, hash->digest, NULL) != 1
+        || EVP_DigestUpdate(outer, pad, block_size) != 1)
+        goto done;
+
+    /* Compute each block of output. */
+    block = 1;
+    for (offset = 0; offset < hash->hash_length; offset += size) {
+        count[0] = (unsigned char) ((block >> 24) & 0xff);
+        count[1] = (unsigned char) ((block >> 16) & 0xff);
+        count[2] = (unsigned char) ((block >> 8) & 0xff);
+        count[3] = (unsigned char) (block & 0xff);
+        block++;
+        if (!hmac(ctx, inner, outer, hash->salt, hash->salt_length, count,
+                  sizeof(count), u))
+            goto done;
+        memcpy(t, u, size);
+        for (j = 1; j < hash->iterations; j++) {
+            if (j % CANCEL_INTERVAL == 0 && check_done(check)) {
+                cancelled = true;
+                goto done;
+            }
+            if (!hmac(ctx, inner, outer, u, size, NULL, 0, u))
+                goto done;
+            for (i = 0; i < size; i++)
+                t[i] ^= u[i];
+        }
+        length = hash->hash_length - offset;
+        memcpy(output + offset, t, (length < size) ? length : size);
+    }
+    okay = true;
+
+done:
+    explicit_bzero(key, sizeof(key));
+    explicit_bzero(pad, sizeof(pad));
+    explicit_bzero(u, sizeof(u));
+    explicit_bzero(t, sizeof(t));
+    EVP_MD_CTX_free(ctx);
+    EVP_MD_CTX_free(inner);
+    EVP_MD_CTX_free(outer);
+    if (!okay && !cancelled)
+        die("cannot compute PBKDF2 hash");
+    return okay;
+}
+
+
+/*
+ * The body of each thread checking the password against history.  Takes the
+ * next unchecked hash and checks it, until a thread finds a match or there
+ * are no hashes left.  Invalid hashes are logged and skipped.
+ */
+static void *
+check_hashes(void *arg)
+{
+    struct history_check *check = arg;
+    struct pbkdf2_hash hash;
+    unsigned char output[MAX_HASH_DATA];
+    const char *error;
+    char *message;
+    size_t i;
+    bool done;
+
+    for (;;) {
+        pthread_mutex_lock(&check->lock);
+        i = check->next++;
+        done = check->found || i >= check->hashes->count;
+        pthread_mutex_unlock(&check->lock);
+        if (done)
+            return NULL;
+        if (!parse_hash(check->hashes->strings[i], &hash, &error)) {
+            xasprintf(&message, "hash validate failed: %s", error);
+            log_error(check->principal, message);
+            free(message);
+            continue;
+        }
+        if (pbkdf2(&hash, check->password, check, output)
+            && CRYPTO_memcmp(output, hash.hash, hash.hash_length) == 0) {
+            pthread_mutex_lock(&check->lock);
+            check->found = true;
+            pthread_mutex_unlock(&check->lock);
+        }
+        explicit_bzero(output, sizeof(output));
+    }
+}
+
+
+/*
+ * Return true if the password matches any of the hashes from history.  Each
+ * check takes about as long as hashing a password, so they are spread across
+ * one thread per CPU, and the remaining checks stop as soon as one matches.
+ * This makes checking the whole history take about as long as one check if
+ * there are enough CPUs.
+ */
+static bool
+hashes_match(const char *principal, const char *password,
+             struct vector *hashes)
+{
+    struct history_check check;
+    pthread_t *threads;
+    long cpus;
+    size_t count, i;
+    int status;
+
+    memset(&check, 0, sizeof(check));
+    check.principal = principal;
+    check.password = password;
+    check.hashes = hashes;
+    pthread_mutex_init(&check.lock, NULL);
+
+    /* Use one thread per CPU, but no more than there are hashes. */
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    count = (cpus < 1) ? 1 : (size_t) cpus;
+    if (count > hashes->count)
+        count = hashes->count;
+    if (count < 2)
+        check_hashes(&check);
+    else {
+        threads = xcalloc(count, sizeof(*threads));
+        for (i = 0; i < count; i++) {
+            status = pthread_create(&threads[i], NULL, check_hashes, &check);
+            if (status != 0) {
+                errno = status;
+                sysdie("cannot create thread");
+            }
+        }
+        for (i = 0; i < count; i++)
+            pthread_join(threads[i], NULL);
+        free(threads);
+    }
+    pthread_mutex_destroy(&check.lock);
+    return check.found;
+}
+
+
+/*
+ * Hash a password with a random salt and the given number of iterations and
+ * return the hash, in the same format as Crypt::PBKDF2, in newly allocated
+ * memory.
+ */
+static char *
+hash_password(const char *password, unsigned long iterations)
+{
+    unsigned char salt[SALT_LENGTH], output[HASH_LENGTH], count[4];
+    char *count_b64, *salt_b64, *output_b64, *result;
+
+    if (RAND_bytes(salt, sizeof(salt)) != 1)
+        die("cannot generate random salt");
+    if (PKCS5_PBKDF2_HMAC(password, (int) strlen(password), salt,
+                          sizeof(salt), (int) iterations, EVP_sha256(),
+                          sizeof(output), output)
+        != 1)
+        die("cannot compute PBKDF2 hash");
+    count[0] = (unsigned char) ((iterations >> 24) & 0xff);
+    count[1] = (unsigned char) ((iterations >> 16) & 0xff);
+    count[2] = (unsigned char) ((iterations >> 8) & 0xff);
+    count[3] = (unsigned char) (iterations & 0xff);
+
+    /* Crypt::PBKDF2 removes the padding from the iteration count. */
+    count_b64 = base64_encode(count, sizeof(count));
+    count_b64[strcspn(count_b64, "=")] = '\0';
+    salt_b64 = base64_encode(salt, sizeof(salt));
+    output_b64 = base64_encode(output, sizeof(output));
+    xasprintf(&result, "%s%s:%s:%s:%s", HASH_PREFIX, HASH_ALGORITHM,
+              count_b64, salt_b64, output_b64);
+    explicit_bzero(output, sizeof(output));
+    free(count_b64);
+    free(salt_b64);
+    free(output_b64);
+    return result;
+}
+
+
+/*
+ * Skip whitespace in JSON text.
+ */
+static void
+json_space(struct json *json)
+{
+    while (json->p < json->end
+           && (*json->p == ' ' || *json->p == '\t' || *json->p == '\n'
+               || *json->p == '\r'))
+        json->p++;
+}
+
+
+/*
+ * Parse a JSON string.  If value is not NULL, store the string in it in newly
+ * allocated memory.  Escapes other than for ASCII characters are not needed
+ * for anything in history, so \u escapes for other characters are accepted
+ * but replaced with a question mark.  Returns false on a syntax error.
+ */
+static bool
+json_string(struct json *json, char **value)
+{
+    const char *start;
+    char *p;
+    char hex[5];
+    unsigned long code;
+
+    if (json->p >= json->end || *json->p != '"')
+        return false;
+    start = ++json->p;
+    while (json->p < json->end && *json->p != '"') {
+        if (*json->p == '\\')
+            json->p++;
+        json->p++;
+    }
+    if (json->p >= json->end)
+        return false;
+    if (value == NULL) {
+        json->p++;
+        return true;
+    }
+
+    /* Decode the string.  It can only get shorter. */
+    *value = xmalloc((size_t) (json->p - start) + 1);
+    for (p = *value; start < json->p; start++) {
+        if (*start != '\\') {
+            *p++ = *start;
+            continue;
+        }
+        start++;
+        switch (*start) {
+        case 'b':
+            *p++ = '\b';
+            break;
+        case 'f':
+            *p++ = '\f';
+            break;
+        case 'n':
+            *p++ = '\n';
+            break;
+        case 'r':
+            *p++ = '\r';
+            break;
+        case 't':
+            *p++ = '\t';
+            break;
+        case 'u':
+            if (json->p - start < 5)
+                goto fail;
+            memcpy(hex, start + 1, 4);
+            hex[4] = '\0';
+            if (strspn(hex, "0123456789abcdefABCDEF") != 4)
+                goto fail;
+            code = strtoul(hex, NULL, 16);
+            *p++ = (code > 0 && code < 0x80) ? (char) code : '?';
+            start += 4;
+            break;
+        default:
+            *p++ = *start;
+            break;
+        }
+    }
+    *p = '\0';
+    json->p++;
+    return true;
+
+fail:
+    free(*value);
+    *value = NULL;
+    return false;
+}
+
+
+/*
+ * Skip over any JSON value, nested no deeper than the given depth.  Returns
+ * false on a syntax error.
+ */
+static bool
+json_skip(struct json *json, unsigned int depth)
+{
+    char close;
+
+    json_space(json);
+    if (json->p >= json->end)
+        return false;
+    if (*json->p == '"')
+        return json_string(json, NULL);
+    if (*json->p != '[' && *json->p != '{') {
+        if (strchr(",]}", *json->p) != NULL)
+            return false;
+        while (json->p < json->end && strchr(",]} \t\r\n", *json->p) == NULL)
+            json->p++;
+        return true;
+    }
+    if (depth == 0)
+        return false;
+    close = (*json->p == '[') ? ']' : '}';
+    json->p++;
+    json_space(json);
+    if (json->p < json->end && *json->p == close) {
+        json->p++;
+        return true;
+    }
+    for (;;) {
+        if (close == '}') {
+            json_space(json);
+            if (!json_string(json, NULL))
+                return false;
+            json_space(json);
+            if (json->p >= json->end || *json->p != ':')
+                return false;
+            json->p++;
+        }
+        if (!json_skip(json, depth - 1))
+            return false;
+        json_space(json);
+        if (json->p >= json->end)
+            return false;
+        if (*json->p == close) {
+            json->p++;
+            return true;
+        }
+        if (*json->p != ',')
+            return false;
+        json->p++;
+    }
+}
+
+
+/*
+ * Parse one history entry, a JSON object, and add the value of its hash key
+ * to hashes if it has one.  Entries that aren't objects are skipped.
+ * Returns false on a syntax error.
+ */
+static bool
+parse_entry(struct json *json, struct vector *hashes)
+{
+    char *key, *value;
+    bool found;
+
+    json_space(json);
+    if (json->p >= json->end || *json->p != '{')
+        return json_skip(json, MAX_JSON_DEPTH);
+    json->p++;
+    json_space(json);
+    if (json->p < json->end && *json->p == '}') {
+        json->p++;
+        return true;
+    }
+    for (;;) {
+        json_space(json);
+        if (!json_string(json, &key))
+            return false;
+        json_space(json);
+        if (json->p >= json->end || *json->p != ':') {
+            free(key);
+            return false;
+        }
+        json->p++;
+        json_space(json);
+        found = (strcmp(key, "hash") == 0 && json->p < json->end
+                 && *json->p == '"');
+        free(key);
+        if (found) {
+            if (!json_string(json, &value))
+                return false;
+            strength_vector_add(hashes, value);
+            free(value);
+        } else if (!json_skip(json, MAX_JSON_DEPTH - 1))
+            return false;
+        json_space(json);
+        if (json->p >= json->end)
+            return false;
+        if (*json->p == '}') {
+            json->p++;
+            return true;
+        }
+        if (*json->p != ',')
+            return false;
+        json->p++;
+    }
+}
+
+
+/*
+ * Parse the history of a principal, a JSON array of objects, and add the
+ * hash of each entry to hashes.  Returns false on a syntax error.
+ */
+static bool
+parse_history(const char *data, size_t length, struct vector *hashes)
+{
+    struct json json = {data, data + length};
+
+    json_space(&json);
+    if (json.p >= json.end || *json.p != '[')
+        return false;
+    json.p++;
+    json_space(&json);
+    if (json.p < json.end && *json.p == ']')
+        json.p++;
+    else
+        for (;;) {
+            if (!parse_entry(&json, hashes))
+                return false;
+            json_space(&json);
+            if (json.p >= json.end)
+                return false;
+            if (*json.p == ']') {
+                json.p++;
+                break;
+            }
+            if (*json.p != ',')
+                return false;
+            json.p++;
+        }
+    json_space(&json);
+    return json.p == json.end;
+}
+
+
+/*
+ * Open and lock a Berkeley DB hash database, creating it if necessary.  The
+ * lock is an exclusive lock on a separate lock file named after the
+ * database, the same as used by the Perl DB_File::Lock module.  Returns 0 on
+ * success or an error code that can be passed to db_strerror.
+ */
+static int
+database_open(const char *path, struct database *database)
+{
+    char *lock_path;
+    int status;
+
+    xasprintf(&lock_path, "%s.lock", path);
+    database->lock_fd = open(lock_path, O_RDWR | O_CREAT, 0600);
+    free(lock_path);
+    if (database->lock_fd < 0)
+        return errno;
+    if (flock(database->lock_fd, LOCK_EX) < 0) {
+        status = errno;
+        goto fail;
+    }
+    status = db_create(&database->db, NULL, 0);
+    if (status != 0)
+        goto fail;
+    status = database->db->open(database->db, NULL, path, NULL, DB_HASH,
+                                DB_CREATE, 0600);
+    if (status != 0) {
+        database->db->close(database->db, 0);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    close(database->lock_fd);
+    return status;
+}
+
+
+/*
+ * Look up a key in an open database.  Returns the value in newly allocated
+ * memory and stores its length in length, or returns NULL if the key is not
+ * found or the lookup fails.
+ */
+static char *
+database_get(struct database *database, const char *key, size_t *length)
+{
+    DBT dbkey, dbvalue;
+
+    memset(&dbkey, 0, sizeof(dbkey));
+    memset(&dbvalue, 0, sizeof(dbvalue));
+    dbkey.data = (void *) key;
+    dbkey.size = (u_int32_t) strlen(key);
+    dbvalue.flags = DB_DBT_MALLOC;
+    if (database->db->get(database->db, NULL, &dbkey, &dbvalue, 0) != 0)
+        return NULL;
+    *length = dbvalue.size;
+    return dbvalue.data;
+}
+
+
+/*
+ * Store a value for a key in an open database, replacing any existing value.
+ * Returns 0 on success or an error code that can be passed to db_strerror.
+ */
+static int
+database_put(struct database *database, const char *key, const char *value,
+             size_t length)
+{
+    DBT dbkey, dbvalue;
+
+    memset(&dbkey, 0, sizeof(dbkey));
+    memset(&dbvalue, 0, sizeof(dbvalue));
+    dbkey.data = (void *) key;
+    dbkey.size = (u_int32_t) strlen(key);
+    dbvalue.data = (void *) value;
+    dbvalue.size = (u_int32_t) length;
+    return database->db->put(database->db, NULL, &dbkey, &dbvalue, 0);
+}
+
+
+/*
+ * Close a database, which writes any changes and releases the lock.  Returns
+ * 0 on success or an error code that can be passed to db_strerror.
+ */
+static int
+database_close(struct database *database)
+{
+    int status;
+
+    status = database->db->close(database->db, 0);
+    close(database->lock_fd);
+    return status;
+}
+
+
+/*
+ * Check whether the password is found in the history of the principal.
+ * Corrupt history and invalid hashes are logged and otherwise treated as if
+ * they weren't present.  Dies if the database can't be opened.
+ */
+static bool
+check_history(const char *path, const char *principal, const char *password)
+{
+    struct database database;
+    struct vector *hashes;
+    char *history;
+    size_t length;
+    bool found = false;
+    int status;
+
+    /* Get the history of the principal. */
+    status = database_open(path, &database);
+    if (status != 0)
+        die("cannot open %s: %s", path, db_strerror(status));
+    history = database_get(&database, principal, &length);
+    database_close(&database);
+    if (history == NULL)
+        return false;
+
+    /* Parse the history and check the password against each hash. */
+    hashes = strength_vector_new();
+    if (hashes == NULL)
+        sysdie("cannot allocate memory");
+    if (!parse_history(history, length, hashes))
+        log_error(principal, "history JSON decoding failed");
+    else
+        found = hashes_match(principal, password, hashes);
+    strength_vector_free(hashes);
+    free(history);
+    return found;
+}
+
+
+/*
+ * Add a new entry for the password to the history of the principal.  The new
+ * entry is added to the start of the existing JSON array, leaving the other
+ * entries exactly as they were.  Existing history that is corrupt is logged
+ * and replaced.  Dies if the database can't be opened.
+ */
+static void
+write_history(const char *path, const char *principal, const char *password)
+{
+    struct database database;
+    struct vector *hashes;
+    char *entry, *history, *value, *rest;
+    size_t length;
+    int status;
+
+    /* Hash the password before locking the database, since it's slow. */
+    value = hash_password(password, HASH_ITERATIONS);
+    xasprintf(&entry, "{\"timestamp\":%ld,\"hash\":\"%s\"}", (long) time(NULL),
+              value);
+    free(value);
+
+    /* Add the entry to the existing history, if any. */
+    status = database_open(path, &database);
+    if (status != 0)
+        die("cannot open %s: %s", path, db_strerror(status));
+    history = database_get(&database, principal, &length);
+    value = NULL;
+    if (history != NULL) {
+        hashes = strength_vector_new();
+        if (hashes == NULL)
+            sysdie("cannot allocate memory");
+        if (!parse_history(history, length, hashes))
+            log_error(principal, "history JSON decoding failed");
+        else {
+            rest = (char *) memchr(history, '[', length) + 1;
+            length -= (size_t) (rest - history);
+            while (length > 0 && isspace((unsigned char) *rest)) {
+                rest++;
+                length--;
+            }
+            if (*rest == ']')
+                xasprintf(&value, "[%s]", entry);
+            else
+                xasprintf(&value, "[%s,%.*s", entry, (int) length, rest);
+        }
+        strength_vector_free(hashes);
+        free(history);
+    }
+    if (value == NULL)
+        xasprintf(&value, "[%s]", entry);
+    status = database_put(&database, principal, value, strlen(value));
+    if (status != 0)
+        warn("cannot store history for %s: %s", principal,
+             db_strerror(status));
+    status = database_close(&database);
+    if (status != 0)
+        warn("cannot close %s: %s", path, db_strerror(status));
+    free(entry);
+    free(value);
+}
+
+
+/*
+ * Increment the count of accepted passwords of the given length in the
+ * length statistics database.  Any failure is ignored, since these
+ * statistics are optional and shouldn't block the password change.
+ */
+static void
+update_length_counts(const char *path, size_t length)
+{
+    struct database database;
+    char key[32], count[32];
+    char *value;
+    unsigned long current = 0;
+    size_t size;
+
+    if (database_open(path, &database) != 0)
+        return;
+    snprintf(key, sizeof(key), "%lu", (unsigned long) length);
+    value = database_get(&database, key, &size);
+    if (value != NULL) {
+        if (size < sizeof(count)) {
+            memcpy(count, value, size);
+            count[size] = '\0';
+            current = strtoul(count, NULL, 10);
+        }
+        free(value);
+    }
+    snprintf(count, sizeof(count), "%lu", current + 1);
+    database_put(&database, key, count, strlen(count));
+    database_close(&database);
+}
+
+
+/*
+ * Do a binary search for the number of hash iterations that makes hashing a
+ * password take the target number of seconds of CPU time, within delta, and
+ * report the progress and result on standard output.  Each measurement
+ * averages twenty hashes.
+ */
+static void
+find_iteration_count(double target, double delta)
+{
+    unsigned long iterations = HASH_ITERATIONS;
+    unsigned long high = 0, low = 0;
+    clock_t start;
+    double seconds;
+    char *hash;
+    int i;
+
+    for (;;) {
+        start = clock();
+        for (i = 0; i < 20; i++) {
+            hash = hash_password("this is a benchmark", iterations);
+            free(hash);
+        }
+        seconds = (double) (clock() - start) / CLOCKS_PER_SEC / 20;
+        printf("Performing %lu iterations takes %.4f seconds\n", iterations,
+               seconds);
+        if (seconds > target - delta && seconds < target + delta)
+            break;
+        if (seconds > target)
+            high = iterations;
+        else
+            low = iterations;
+        if (seconds < target && high == 0)
+            iterations *= 2;
+        else
+            iterations = (high + low) / 2;
+    }
+    printf("Use %lu iterations\n", iterations);
+}
+
+
+/*
+ * Read a key/value line in the Heimdal external-check format from standard
+ * input, check that the key is the one expected, and store the value in the
+ * provided buffer.  Dies on any error.
+ */
+static void
+read_key(const char *key, char *buffer, size_t length)
+{
+    size_t size;
+    int max = (length < INT_MAX) ? (int) length : INT_MAX;
+
+    if (fgets(buffer, max, stdin) == NULL)
+        die("truncated input before %s", key);
+    size = strlen(buffer);
+    if (size < 1 || buffer[size - 1] != '\n')
+        die("malformed or too long input line before %s", key);
+    buffer[size - 1] = '\0';
+    if (strncmp(buffer, key, strlen(key)) != 0
+        || buffer[strlen(key)] != ':' || buffer[strlen(key) + 1] != ' ')
+        die("unrecognized input line before %s", key);
+    memmove(buffer, buffer + strlen(key) + 2, size - strlen(key) - 2);
+}
+
+
+/*
+ * Check the strength of the password with the same checks as
+ * heimdal-strength.  Called in a child process after dropping privileges.
+ * If the password is rejected, write the reason to the given file
+ * descriptor.
+ */
+static void
+run_strength_check(const char *principal, const char *password, int fd)
+{
+    krb5_context ctx;
+    krb5_pwqual_moddata data;
+    krb5_error_code code;
+    const char *message;
+    size_t length, offset;
+    ssize_t status;
+
+    code = krb5_init_context(&ctx);
+    if (code != 0)
+        die_krb5(ctx, code, "cannot create Kerberos context");
+    code = strength_init(ctx, NULL, &data);
+    if (code != 0)
+        die_krb5(ctx, code, "cannot initialize strength checking");
+    code = strength_check(ctx, data, principal, password);
+    if (code != 0) {
+        message = krb5_get_error_message(ctx, code);
+        length = strlen(message);
+        for (offset = 0; offset < length; offset += (size_t) status) {
+            status = write(fd, message + offset, length - offset);
+            if (status < 0 && errno != EINTR)
+                sysdie("cannot write strength check result");
+            if (status < 0)
+                status = 0;
+        }
+        krb5_free_error_message(ctx, message);
+    }
+    strength_close(ctx, data);
+    krb5_free_context(ctx);
+}
+
+
+/*
+ * Check the strength of the password in a child process running as
+ * STRENGTH_USER and STRENGTH_GROUP, like heimdal-strength is run by
+ * heimdal-history, so that the checks never run with access to the history
+ * database.  The child passes back only the reason for rejection, if any.  If
+ * the password is rejected, log that, report the reason on standard error,
+ * and exit.
+ */
+static void
+check_strength(const char *principal, const char *password)
+{
+    char message[BUFSIZ];
+    size_t length = 0;
+    ssize_t status;
+    pid_t child;
+    int fds[2], result;
+
+    if (pipe(fds) < 0)
+        sysdie("cannot create pipe");
+    child = fork();
+    if (child < 0)
+        sysdie("cannot fork");
+    if (child == 0) {
+        close(fds[0]);
+        drop_privileges(STRENGTH_USER, STRENGTH_GROUP);
+        run_strength_check(principal, password, fds[1]);
+        exit(0);
+    }
+
+    /* Collect the rejection message, if any, and wait for the child. */
+    close(fds[1]);
+    do {
+        status = read(fds[0], message + length, sizeof(message) - length - 1);
+        if (status > 0)
+            length += (size_t) status;
+    } while (length < sizeof(message) - 1
+             && (status > 0 || (status < 0 && errno == EINTR)));
+    if (status < 0)
+        sysdie("cannot read strength check result");
+    close(fds[0]);
+    message[length] = '\0';
+    while (waitpid(child, &result, 0) < 0)
+        if (errno != EINTR)
+            sysdie("cannot wait for strength check process");
+
+    /* The child reports its own errors, so just exit on failure. */
+    if (WIFSIGNALED(result))
+        die("strength check process killed by signal %d", WTERMSIG(result));
+    if (WEXITSTATUS(result) != 0)
+        exit(1);
+    if (length > 0) {
+        log_result(principal, "rejected", message);
+        fprintf(stderr, "%s\n", message);
+        exit(0);
+    }
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    char principal[BUFSIZ], password[BUFSIZ], end[BUFSIZ];
+    const char *database = HISTORY_PATH;
+    const char *stats = LENGTH_STATS_PATH;
+    bool check_only = false;
+    double benchmark = 0;
+    char *p;
+    int option;
+
+    message_program_name = "heimdal-history-native";
+
+    /* Parse options. */
+    while ((option = getopt(argc, argv, "b:cd:hqS:")) != EOF) {
+        switch (option) {
+        case 'b':
+            benchmark = strtod(optarg, &p);
+            if (*p != '\0' || benchmark <= 0)
+                die("invalid benchmark target %s", optarg);
+            break;
+        case 'c':
+            check_only = true;
+            break;
+        case 'd':
+            database = optarg;
+            break;
+        case 'h':
+            usage(0);
+        case 'q':
+            use_syslog = false;
+            break;
+        case 'S':
+            stats = optarg;
+            break;
+        default:
+            usage(1);
+        }
+    }
+    if (argc - optind > 1)
+        usage(1);
+
+    /* If asked to benchmark, do only that. */
+    if (benchmark > 0) {
+        find_iteration_count(benchmark, 0.005);
+        exit(0);
+    }
+
+    /* Read the principal and password to check. */
+    if (use_syslog)
+        openlog(SYSLOG_IDENT, LOG_PID, LOG_AUTH);
+    read_key("principal", principal, sizeof(principal));
+    read_key("new-password", password, sizeof(password));
+    if (fgets(end, sizeof(end), stdin) == NULL)
+        die("truncated input before end");
+    if (strcmp(end, "end\n") != 0)
+        die("unrecognized input line before end");
+
+    /*
+     * Check strength in a separate, unprivileged process, and then drop
+     * privileges to the history user before touching the history database.
+     */
+    check_strength(principal, password);
+    drop_privileges(HISTORY_USER, HISTORY_GROUP);
+
+    /* Check history and reject the password if it was used before. */
+    if (check_history(database, principal, password)) {
+        log_result(principal, "rejected", REJECT_MESSAGE);
+        fprintf(stderr, "%s\n", REJECT_MESSAGE);
+        explicit_bzero(password, sizeof(password));
+        exit(0);
+    }
+
+    /* The password is accepted.  Record it and update the length counts. */
+    log_result(principal, "accepted", NULL);
+    if (!check_only) {
+        write_history(database, principal, password);
+        update_length_counts(stats, strlen(password));
+    }
+    explicit_bzero(password, sizeof(password));
+    if (printf("APPROVED\n") < 0 || fflush(stdout) == EOF)
+        sysdie("cannot write to standard output");
+    exit(0);
+}
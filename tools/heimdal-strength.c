@@ -6,8 +6,15 @@
  * interface.  It uses a krb5.conf parameter to determine the location of its
  * dictionary.
  *
+ * Since initializing the checks can be much more expensive than checking a
+ * single password, it can also run as a server on a Unix domain socket,
+ * keeping its checks initialized between passwords, and as a client of that
+ * server that can be run by kpasswdd in place of the full program.  A batch
+ * mode checks any number of passwords read from standard input, for auditing
+ * or migrating a large set of passwords.
+ *
  * Written by Russ Allbery <eagle@eyrie.org>
- * Copyright 2020 Russ Allbery <eagle@eyrie.org>
+ * Copyright 2020, 2026 Russ Allbery <eagle@eyrie.org>
  * Copyright 2009, 2013
  *     The Board of Trustees of the Leland Stanford Junior University
  *
@@ -19,6 +26,10 @@
 #include <portable/system.h>
 
 #include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include <plugin/internal.h>
 #include <util/macros.h>
@@ -26,60 +37,500 @@
 #include <util/messages.h>
 #include <util/xmalloc.h>
 
+/* Usage message. */
+static const char usage_message[] = "\
+Usage: heimdal-strength [-ah] [-b <format> | -c <socket> | -s <socket>]\n\
+                        [<principal>]\n\
+\n\
+Options:\n\
+    -a          Run every check and list all that reject the password\n\
+    -b <format> Check every record on input, in records or tsv format\n\
+    -c <socket> Send the password to a heimdal-strength server to check\n\
+    -h          Print this usage message and exit\n\
+    -s <socket> Run as a server checking passwords sent to the socket\n";
+
+/* The prefix of a line from the server that should go to standard error. */
+#define ERROR_PREFIX "error: "
+
+/* Size of the standard input and output buffers in batch mode. */
+#define BATCH_BUFSIZ (1024 * 1024)
+
+/* Seconds a client may stay connected to the server. */
+#define CONNECTION_TIMEOUT 10
+
+/* A request to check a password, or the reason it couldn't be read. */
+struct request {
+    char principal[BUFSIZ];
+    char password[BUFSIZ];
+    char error[BUFSIZ];
+};
 
 /*
- * Read a key/value pair from stdin, check that the key is the one expected,
- * and if so, copy the value into the provided buffer.  Exits with an
- * appropriate error on failure.
+ * The connection the server is handling, which is shut down when its time is
+ * up, and whether that happened.
  */
-static void
-read_key(const char *key, char *buffer, size_t length)
+static volatile sig_atomic_t connection_fd = -1;
+static volatile sig_atomic_t connection_expired = 0;
+
+/* The result of reading a request. */
+enum read_status {
+    READ_OK,    /* Read a complete request */
+    READ_EOF,   /* End of input before the start of a request */
+    READ_ERROR, /* Malformed request or read error, see error */
+};
+
+
+/*
+ * Read a key/value pair from input, check that the key is the one expected,
+ * and if so, copy the value into the provided buffer.  Returns false and sets
+ * the error in the request on failure.
+ */
+static bool
+read_key(FILE *input, const char *key, char *buffer, size_t length,
+         struct request *request)
 {
     char *p;
     int size = (length < INT_MAX) ? (int) length : INT_MAX;
 
-    if (fgets(buffer, size, stdin) == NULL)
-        sysdie("Cannot read %s", key);
-    if (strlen(buffer) < 1 || buffer[strlen(buffer) - 1] != '\n')
-        die("Malformed or too long %s line", key);
+    if (fgets(buffer, size, input) == NULL) {
+        snprintf(request->error, sizeof(request->error), "Cannot read %s: %s",
+                 key, strerror(errno));
+        return false;
+    }
+    if (strlen(buffer) < 1 || buffer[strlen(buffer) - 1] != '\n') {
+        snprintf(request->error, sizeof(request->error),
+                 "Malformed or too long %s line", key);
+        return false;
+    }
     buffer[strlen(buffer) - 1] = '\0';
     if (strncmp(buffer, key, strlen(key)) != 0)
-        die("Malformed %s line", key);
+        goto malformed;
     p = buffer + strlen(key);
     if (p[0] != ':' || p[1] != ' ')
-        die("Malformed %s line", key);
+        goto malformed;
     p += 2;
     memmove(buffer, p, strlen(p) + 1);
+    return true;
+
+malformed:
+    snprintf(request->error, sizeof(request->error), "Malformed %s line",
+             key);
+    return false;
+}
+
+
+/*
+ * Read a principal and password in the format used by the Heimdal
+ * external-check interface.  Returns READ_EOF if the input ends before the
+ * request starts, which is also described in the error in the request for
+ * callers that expect a request.
+ */
+static enum read_status
+read_request(FILE *input, struct request *request)
+{
+    char end[BUFSIZ];
+    int c;
+
+    errno = 0;
+    c = getc(input);
+    if (c == EOF) {
+        read_key(input, "principal", request->principal,
+                 sizeof(request->principal), request);
+        return ferror(input) ? READ_ERROR : READ_EOF;
+    }
+    ungetc(c, input);
+    if (!read_key(input, "principal", request->principal,
+                  sizeof(request->principal), request))
+        return READ_ERROR;
+    if (!read_key(input, "new-password", request->password,
+                  sizeof(request->password), request))
+        return READ_ERROR;
+    if (fgets(end, sizeof(end), input) == NULL) {
+        snprintf(request->error, sizeof(request->error),
+                 "Cannot read end of entry: %s", strerror(errno));
+        return READ_ERROR;
+    }
+    if (strcmp(end, "end\n") != 0) {
+        snprintf(request->error, sizeof(request->error),
+                 "Malformed end line");
+        return READ_ERROR;
+    }
+    return READ_OK;
+}
+
+
+/*
+ * Read a principal and password from a single line of input, separated by a
+ * tab.  The password is everything after the first tab.  Returns READ_EOF at
+ * the end of input, like read_request.
+ */
+static enum read_status
+read_tsv(FILE *input, struct request *request)
+{
+    char line[BUFSIZ * 2];
+    char *tab;
+    size_t length;
+
+    errno = 0;
+    if (fgets(line, sizeof(line), input) == NULL) {
+        snprintf(request->error, sizeof(request->error),
+                 "Cannot read line: %s", strerror(errno));
+        return ferror(input) ? READ_ERROR : READ_EOF;
+    }
+    length = strlen(line);
+    if (length < 1 || line[length - 1] != '\n')
+        goto malformed;
+    line[length - 1] = '\0';
+    tab = strchr(line, '\t');
+    if (tab == NULL)
+        goto malformed;
+    *tab = '\0';
+    if (strlen(line) >= sizeof(request->principal)
+        || strlen(tab + 1) >= sizeof(request->password))
+        goto malformed;
+    strcpy(request->principal, line);
+    strcpy(request->password, tab + 1);
+    explicit_bzero(line, sizeof(line));
+    return READ_OK;
+
+malformed:
+    explicit_bzero(line, sizeof(line));
+    snprintf(request->error, sizeof(request->error),
+             "Malformed or too long line");
+    return READ_ERROR;
+}
+
+
+/*
+ * Print usage information and exit with the given status.
+ */
+__attribute__((__noreturn__)) static void
+usage(int status)
+{
+    fprintf((status == 0) ? stdout : stderr, "%s", usage_message);
+    exit(status);
 }
 
 
 /*
- * Read a principal and password from standard input and do strength checking
- * on that principal and password, returning the results expected by the
- * Heimdal external-check interface.  Takes the password strength checking
- * context.
+ * Print REJECTED followed by the names of all of the checks that rejected a
+ * password, given the mask of failures from strength_check_all, without a
+ * trailing newline.
  */
 static void
-check_password(krb5_context ctx, krb5_pwqual_moddata data)
+print_failures(FILE *output, unsigned long failures)
+{
+    const char *name;
+    size_t i;
+
+    fprintf(output, "REJECTED");
+    for (i = 0; (name = strength_check_name(i)) != NULL; i++)
+        if (failures & (1UL << i))
+            fprintf(output, " %s", name);
+}
+
+
+/*
+ * Do strength checking on the principal and password of a request.  Takes
+ * the password strength checking context and whether to run every check, in
+ * which case failures is set to the mask of checks that rejected the
+ * password.  Returns the status of the check, with the reason for rejecting
+ * the password in the Kerberos context.
+ */
+static krb5_error_code
+run_checks(krb5_context ctx, krb5_pwqual_moddata data, bool all,
+           const struct request *request, unsigned long *failures)
+{
+    *failures = 0;
+    if (all)
+        return strength_check_all(ctx, data, request->principal,
+                                  request->password, failures);
+    else
+        return strength_check(ctx, data, request->principal,
+                              request->password);
+}
+
+
+/*
+ * Do strength checking on the principal and password of a request, printing
+ * the results expected by the Heimdal external-check interface on output.
+ * If all is true and the password is rejected, also print the names of all
+ * of the checks that rejected it.  Returns the status of the check, with the
+ * reason for rejecting the password in the Kerberos context.
+ */
+static krb5_error_code
+check_password(krb5_context ctx, krb5_pwqual_moddata data, bool all,
+               const struct request *request, FILE *output)
 {
-    char principal[BUFSIZ], password[BUFSIZ], end[BUFSIZ];
     krb5_error_code code;
-    const char *message;
+    unsigned long failures;
 
-    read_key("principal", principal, sizeof(principal));
-    read_key("new-password", password, sizeof(password));
-    if (fgets(end, sizeof(end), stdin) == NULL)
-        sysdie("Cannot read end of entry");
-    if (strcmp(end, "end\n") != 0)
-        die("Malformed end line");
-    code = strength_check(ctx, data, principal, password);
+    code = run_checks(ctx, data, all, request, &failures);
     if (code == 0)
-        printf("APPROVED\n");
-    else {
-        message = krb5_get_error_message(ctx, code);
-        fprintf(stderr, "%s\n", message);
-        krb5_free_error_message(ctx, message);
+        fprintf(output, "APPROVED\n");
+    else if (all) {
+        print_failures(output, failures);
+        fprintf(output, "\n");
+    }
+    return code;
+}
+
+
+/*
+ * Check every record on standard input, either in the format used by the
+ * Heimdal external-check interface or as lines with the principal and the
+ * password separated by a tab, printing one line of results for each.  Each
+ * line has the principal, a tab, and what would be printed on standard
+ * output by a standalone check of the password, and if the password was
+ * rejected, another tab and the reason.  Both standard input and standard
+ * output use large buffers.  Dies on malformed input.
+ */
+static void
+batch(krb5_context ctx, krb5_pwqual_moddata data, bool all, bool tsv)
+{
+    struct request request;
+    enum read_status status;
+    krb5_error_code code;
+    unsigned long failures, record;
+    const char *message;
+
+    if (setvbuf(stdin, xmalloc(BATCH_BUFSIZ), _IOFBF, BATCH_BUFSIZ) != 0
+        || setvbuf(stdout, xmalloc(BATCH_BUFSIZ), _IOFBF, BATCH_BUFSIZ) != 0)
+        die("Cannot set up buffering");
+    for (record = 1;; record++) {
+        if (tsv)
+            status = read_tsv(stdin, &request);
+        else
+            status = read_request(stdin, &request);
+        if (status == READ_EOF)
+            break;
+        if (status == READ_ERROR)
+            die("Record %lu: %s", record, request.error);
+        code = run_checks(ctx, data, all, &request, &failures);
+        explicit_bzero(request.password, sizeof(request.password));
+        fprintf(stdout, "%s\t", request.principal);
+        if (code == 0)
+            fprintf(stdout, "APPROVED\n");
+        else {
+            if (all)
+                print_failures(stdout, failures);
+            else
+                fprintf(stdout, "REJECTED");
+            message = krb5_get_error_message(ctx, code);
+            fprintf(stdout, "\t%s\n", message);
+            krb5_free_error_message(ctx, message);
+        }
+    }
+    if (fflush(stdout) == EOF)
+        sysdie("Cannot write results");
+}
+
+
+/*
+ * Signal handler for the end of the time allowed for a connection.  Shut
+ * down the connection so that any read or write on it, including one already
+ * blocked, fails immediately.
+ */
+static void
+expire_connection(int sig UNUSED)
+{
+    if (connection_fd >= 0) {
+        shutdown(connection_fd, SHUT_RDWR);
+        connection_expired = 1;
+    }
+}
+
+
+/*
+ * Handle a single connection to the server.  Each request on the connection
+ * gets a reply consisting of whatever would be printed on standard output by
+ * a standalone check, the reason the password was rejected if it was, on a
+ * line starting with "error: ", and a line containing only "end".  Malformed
+ * input gets an error reply, after which the connection is closed.  Since
+ * connections are handled one at a time, the connection is shut down
+ * CONNECTION_TIMEOUT seconds after it was accepted, however much the client
+ * is sending or reading, so that no client can block the others.  If
+ * krb5.conf or a dictionary has changed, the checks are initialized again
+ * before checking the next password.
+ */
+static void
+serve_connection(krb5_context ctx, krb5_pwqual_moddata *data, bool all,
+                 int fd)
+{
+    FILE *input, *output;
+    struct request request;
+    enum read_status status;
+    krb5_error_code code;
+    const char *message;
+    int out_fd;
+
+    out_fd = dup(fd);
+    input = fdopen(fd, "r");
+    output = (out_fd < 0) ? NULL : fdopen(out_fd, "w");
+    if (input == NULL || output == NULL) {
+        syswarn("Cannot set up connection");
+        if (input == NULL)
+            close(fd);
+        else
+            fclose(input);
+        if (output != NULL)
+            fclose(output);
+        else if (out_fd >= 0)
+            close(out_fd);
+        return;
+    }
+    connection_expired = 0;
+    connection_fd = fd;
+    alarm(CONNECTION_TIMEOUT);
+    while ((status = read_request(input, &request)) != READ_EOF) {
+        if (status == READ_ERROR) {
+            if (!connection_expired)
+                fprintf(output, "%s%s\nend\n", ERROR_PREFIX, request.error);
+            break;
+        }
+        code = 0;
+        if (*data == NULL || strength_policy_changed(*data)) {
+            strength_close(ctx, *data);
+            code = strength_init_watched(ctx, NULL, data);
+        }
+        if (code == 0)
+            code = check_password(ctx, *data, all, &request, output);
+        explicit_bzero(request.password, sizeof(request.password));
+        if (code != 0) {
+            message = krb5_get_error_message(ctx, code);
+            fprintf(output, "%s%s\n", ERROR_PREFIX, message);
+            krb5_free_error_message(ctx, message);
+        }
+        fprintf(output, "end\n");
+        if (fflush(output) == EOF)
+            break;
+    }
+    alarm(0);
+    connection_fd = -1;
+    if (connection_expired)
+        warn("Dropping connection after timeout");
+    explicit_bzero(request.password, sizeof(request.password));
+    fclose(input);
+    fclose(output);
+}
+
+
+/*
+ * Run as a server, listening on a Unix domain socket at path and checking
+ * every password sent to it.  The socket is only accessible by the user
+ * running the server.  Connections are handled one at a time, each with any
+ * number of requests until the client goes away or its time is up, and the
+ * checks are kept initialized between them.
+ * Never returns.
+ */
+__attribute__((__noreturn__)) static void
+serve(krb5_context ctx, const char *path, bool all)
+{
+    struct sockaddr_un addr;
+    struct sigaction sa;
+    krb5_pwqual_moddata data;
+    krb5_error_code code;
+    int fd, client;
+
+    /* Initialize the checks before accepting connections. */
+    code = strength_init_watched(ctx, NULL, &data);
+    if (code != 0)
+        die_krb5(ctx, code, "Cannot initialize strength checking");
+
+    /* Create the socket, replacing any left over from a previous server. */
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        die("Socket path %s too long", path);
+    strcpy(addr.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        sysdie("Cannot create socket");
+    if (unlink(path) < 0 && errno != ENOENT)
+        sysdie("Cannot remove old socket %s", path);
+    umask(077);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+        sysdie("Cannot bind to %s", path);
+    if (listen(fd, SOMAXCONN) < 0)
+        sysdie("Cannot listen on %s", path);
+
+    /*
+     * A client going away shouldn't kill the server, and each connection is
+     * shut down when its time is up.
+     */
+    signal(SIGPIPE, SIG_IGN);
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = expire_connection;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGALRM, &sa, NULL) < 0)
+        sysdie("Cannot set up connection timeout");
+
+    /* Handle connections forever. */
+    for (;;) {
+        client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            if (errno != EINTR)
+                syswarn("Cannot accept connection");
+            continue;
+        }
+        serve_connection(ctx, &data, all, client);
+    }
+}
+
+
+/*
+ * Run as a client of a server listening on path.  Read a principal and
+ * password from standard input, send them to the server, and print the
+ * reply in the same way that a standalone check would.  This doesn't need a
+ * Kerberos context, which keeps it cheap to run once per password.
+ */
+static void
+client(const char *path)
+{
+    struct sockaddr_un addr;
+    struct request request;
+    char line[BUFSIZ];
+    FILE *server;
+    int fd;
+
+    /* Read the request first so that malformed input isn't sent. */
+    if (read_request(stdin, &request) != READ_OK) {
+        explicit_bzero(request.password, sizeof(request.password));
+        die("%s", request.error);
+    }
+
+    /* Connect to the server. */
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        die("Socket path %s too long", path);
+    strcpy(addr.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        sysdie("Cannot create socket");
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+        sysdie("Cannot connect to %s", path);
+    server = fdopen(fd, "r+");
+    if (server == NULL)
+        sysdie("Cannot set up connection to %s", path);
+
+    /* Send the request and copy the reply. */
+    fprintf(server, "principal: %s\nnew-password: %s\nend\n",
+            request.principal, request.password);
+    explicit_bzero(request.password, sizeof(request.password));
+    if (fflush(server) == EOF)
+        sysdie("Cannot send request to %s", path);
+    while (fgets(line, sizeof(line), server) != NULL) {
+        if (strcmp(line, "end\n") == 0) {
+            fclose(server);
+            return;
+        }
+        if (strncmp(line, ERROR_PREFIX, strlen(ERROR_PREFIX)) == 0)
+            fputs(line + strlen(ERROR_PREFIX), stderr);
+        else
+            fputs(line, stdout);
     }
+    die("Incomplete reply from %s", path);
 }
 
 
@@ -91,26 +542,95 @@ check_password(krb5_context ctx, krb5_pwqual_moddata data)
  * program would normally be, so allow for that behavior as well.
  */
 int
-main(int argc, char *argv[] UNUSED)
+main(int argc, char *argv[])
 {
     krb5_context ctx;
     krb5_error_code code;
     krb5_pwqual_moddata data;
+    struct request request;
+    const char *message;
+    const char *format = NULL;
+    const char *client_path = NULL;
+    const char *server_path = NULL;
+    bool all = false;
+    int option;
+
+    /* Parse options. */
+    while ((option = getopt(argc, argv, "ab:c:hs:")) != EOF) {
+        switch (option) {
+        case 'a':
+            all = true;
+            break;
+        case 'b':
+            format = optarg;
+            break;
+        case 'c':
+            client_path = optarg;
+            break;
+        case 'h':
+            usage(0);
+        case 's':
+            server_path = optarg;
+            break;
+        default:
+            usage(1);
+        }
+    }
+
+    /*
+     * Check command-line arguments.  Whether to run every check is up to the
+     * server, so -a can't be given with -c.
+     */
+    if (argc - optind > 1)
+        usage(1);
+    if (client_path != NULL && (server_path != NULL || all))
+        usage(1);
+    if (format != NULL && (client_path != NULL || server_path != NULL))
+        usage(1);
+    if (format != NULL && strcmp(format, "records") != 0
+        && strcmp(format, "tsv") != 0)
+        usage(1);
 
-    /* Check command-line arguments. */
-    if (argc != 1 && argc != 2)
-        die("Usage: heimdal-strength <principal>");
+    /* In client mode, just pass the request on to the server. */
+    if (client_path != NULL) {
+        client(client_path);
+        exit(0);
+    }
 
-    /* Initialize Kerberos and the module. */
+    /* Initialize Kerberos. */
     code = krb5_init_context(&ctx);
     if (code != 0)
         die_krb5(ctx, code, "Cannot create Kerberos context");
+
+    /* In server mode, check passwords until killed. */
+    if (server_path != NULL)
+        serve(ctx, server_path, all);
+
+    /* Initialize the module. */
     code = strength_init(ctx, NULL, &data);
     if (code != 0)
         die_krb5(ctx, code, "Cannot initialize strength checking");
 
+    /* In batch mode, check every record on standard input. */
+    if (format != NULL) {
+        batch(ctx, data, all, strcmp(format, "tsv") == 0);
+        strength_close(ctx, data);
+        krb5_free_context(ctx);
+        exit(0);
+    }
+
     /* Check the password and report results. */
-    check_password(ctx, data);
+    if (read_request(stdin, &request) != READ_OK) {
+        explicit_bzero(request.password, sizeof(request.password));
+        die("%s", request.error);
+    }
+    code = check_password(ctx, data, all, &request, stdout);
+    explicit_bzero(request.password, sizeof(request.password));
+    if (code != 0) {
+        message = krb5_get_error_message(ctx, code);
+        fprintf(stderr, "%s\n", message);
+        krb5_free_error_message(ctx, message);
+    }
 
     /* Close and free resources. */
     strength_close(ctx, data);
@@ -0,0 +1,365 @@
+/*
+ * Check a large corpus of passwords against the password strength checks.
+ *
+ * Reads a file of principals and passwords, one per line separated by a tab,
+ * and checks every password with the configured checks, reporting how many
+ * were rejected for each reason and how quickly they were checked.  The file
+ * is mapped into memory and split into chunks at line boundaries, and each
+ * chunk is checked by its own thread with its own Kerberos context and
+ * password strength checking context, so the checks themselves need no
+ * locking.  The exception is CrackLib, which is not reentrant, so if a
+ * CrackLib dictionary is configured, the checks are serialized.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/krb5.h>
+#include <portable/system.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <plugin/internal.h>
+#include <util/macros.h>
+#include <util/messages-krb5.h>
+#include <util/messages.h>
+#include <util/xmalloc.h>
+
+/* Usage message. */
+static const char usage_message[] = "\
+Usage: krb5-strength-audit [-ah] [-t <threads>] <file>\n\
+\n\
+Options:\n\
+    -a          Run every check and count all that reject each password\n\
+    -h          Print this usage message and exit\n\
+    -t <count>  Number of threads to use (default: one per CPU)\n";
+
+/* The number of passwords rejected for one reason. */
+struct reason {
+    char *reason;
+    unsigned long count;
+};
+
+/* A table of reasons for rejecting passwords. */
+struct reasons {
+    struct reason *reasons;
+    size_t count;
+};
+
+/* The work and results of one thread. */
+struct worker {
+    pthread_t thread;            /* Thread checking this chunk */
+    const char *start;           /* Start of the chunk of the file */
+    const char *end;             /* End of the chunk of the file */
+    bool all;                    /* Whether to run every check */
+    pthread_mutex_t *lock;       /* Held around checks using CrackLib */
+    krb5_context ctx;            /* Kerberos context for this thread */
+    krb5_pwqual_moddata data;    /* Password checks for this thread */
+    unsigned long checked;       /* Number of passwords checked */
+    unsigned long rejected;      /* Number of passwords rejected */
+    unsigned long malformed;     /* Number of lines without a tab */
+    struct reasons reasons;      /* Rejections by reason */
+};
+
+
+/*
+ * Print usage information and exit with the given status.
+ */
+__attribute__((__noreturn__)) static void
+usage(int status)
+{
+    fprintf((status == 0) ? stdout : stderr, "%s", usage_message);
+    exit(status);
+}
+
+
+/*
+ * Add count rejections for the given reason to a table of reasons.  There are
+ * only ever a handful of distinct reasons, so a linear search is fine.
+ */
+static void
+add_reason(struct reasons *reasons, const char *reason, unsigned long count)
+{
+    struct reason *entry;
+    size_t i;
+
+    for (i = 0; i < reasons->count; i++)
+        if (strcmp(reasons->reasons[i].reason, reason) == 0) {
+            reasons->reasons[i].count += count;
+            return;
+        }
+    reasons->reasons = xreallocarray(reasons->reasons, reasons->count + 1,
+                                     sizeof(*reasons->reasons));
+    entry = &reasons->reasons[reasons->count];
+    entry->reason = xstrdup(reason);
+    entry->count = count;
+    reasons->count++;
+}
+
+
+/*
+ * Check one password and record the result in the worker.  Without all, the
+ * reason is the error message of the check that rejected the password.  With
+ * all, each check that rejected the password is counted under its name.
+ *
+ * CrackLib is not reentrant, so the lock shared by all workers is held around
+ * the check if the policy for the principal uses CrackLib.  Each realm can
+ * configure its own dictionary, so this is decided for each password.
+ */
+static void
+check_password(struct worker *worker, const char *principal,
+               const char *password)
+{
+    krb5_pwqual_moddata policy;
+    krb5_error_code code;
+    unsigned long failures = 0;
+    const char *message, *name;
+    bool locked;
+    size_t i;
+
+    code = strength_policy_select(worker->ctx, worker->data, NULL, principal,
+                                  &policy);
+    locked = (code == 0 && policy->dictionary != NULL);
+    if (locked)
+        pthread_mutex_lock(worker->lock);
+    if (worker->all)
+        code = strength_check_all(worker->ctx, worker->data, principal,
+                                  password, &failures);
+    else
+        code = strength_check(worker->ctx, worker->data, principal, password);
+    if (locked)
+        pthread_mutex_unlock(worker->lock);
+    worker->checked++;
+    if (code == 0)
+        return;
+    worker->rejected++;
+    if (worker->all) {
+        for (i = 0; (name = strength_check_name(i)) != NULL; i++)
+            if (failures & (1UL << i))
+                add_reason(&worker->reasons, name, 1);
+    } else {
+        message = krb5_get_error_message(worker->ctx, code);
+        add_reason(&worker->reasons, message, 1);
+        krb5_free_error_message(worker->ctx, message);
+    }
+}
+
+
+/*
+ * The body of each thread.  Checks every line in the worker's chunk of the
+ * file.  Lines are copied out so that the principal and password are
+ * nul-terminated, and lines without a tab or too long for the buffers are
+ * counted as malformed.
+ */
+static void *
+run_worker(void *arg)
+{
+    struct worker *worker = arg;
+    char principal[BUFSIZ], password[BUFSIZ];
+    const char *line, *end, *tab;
+    size_t length;
+
+    for (line = worker->start; line < worker->end; line = end + 1) {
+        end = memchr(line, '\n', (size_t) (worker->end - line));
+        if (end == NULL)
+            end = worker->end;
+        if (end == line)
+            continue;
+        tab = memchr(line, '\t', (size_t) (end - line));
+        if (tab == NULL || (size_t) (tab - line) >= sizeof(principal)
+            || (size_t) (end - tab - 1) >= sizeof(password)) {
+            worker->malformed++;
+            continue;
+        }
+        length = (size_t) (tab - line);
+        memcpy(principal, line, length);
+        principal[length] = '\0';
+        length = (size_t) (end - tab - 1);
+        memcpy(password, tab + 1, length);
+        password[length] = '\0';
+        check_password(worker, principal, password);
+    }
+    return NULL;
+}
+
+
+/*
+ * Compare two reasons for sorting, by decreasing count and then by reason.
+ */
+static int
+compare_reasons(const void *a, const void *b)
+{
+    const struct reason *first = a;
+    const struct reason *second = b;
+
+    if (first->count != second->count)
+        return (first->count > second->count) ? -1 : 1;
+    return strcmp(first->reason, second->reason);
+}
+
+
+/*
+ * Combine the results of all of the workers and print them, along with the
+ * elapsed time in microseconds and the resulting throughput.
+ */
+static void
+report(struct worker *workers, size_t count, uint64_t elapsed)
+{
+    struct reasons reasons = {NULL, 0};
+    unsigned long checked = 0, rejected = 0, malformed = 0;
+    double seconds;
+    size_t i, j;
+
+    for (i = 0; i < count; i++) {
+        checked += workers[i].checked;
+        rejected += workers[i].rejected;
+        malformed += workers[i].malformed;
+        for (j = 0; j < workers[i].reasons.count; j++)
+            add_reason(&reasons, workers[i].reasons.reasons[j].reason,
+                       workers[i].reasons.reasons[j].count);
+    }
+    seconds = (double) elapsed / 1000000.0;
+    printf("Checked %lu passwords in %.2f seconds", checked, seconds);
+    if (seconds > 0)
+        printf(" (%.0f per second)", (double) checked / seconds);
+    printf(" with %lu threads\n", (unsigned long) count);
+    printf("Approved: %lu\n", checked - rejected);
+    printf("Rejected: %lu\n", rejected);
+    if (malformed > 0)
+        printf("Malformed: %lu\n", malformed);
+    qsort(reasons.reasons, reasons.count, sizeof(*reasons.reasons),
+          compare_reasons);
+    for (i = 0; i < reasons.count; i++) {
+        printf("%12lu  %s\n", reasons.reasons[i].count,
+               reasons.reasons[i].reason);
+        free(reasons.reasons[i].reason);
+    }
+    free(reasons.reasons);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    struct worker *workers;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    krb5_error_code code;
+    struct stat st;
+    const char *map, *start, *end, *split;
+    char *p;
+    bool all = false;
+    long threads = 0;
+    uint64_t started;
+    size_t i, j;
+    int fd, option, status;
+
+    message_program_name = "krb5-strength-audit";
+
+    /* Parse options. */
+    while ((option = getopt(argc, argv, "aht:")) != EOF) {
+        switch (option) {
+        case 'a':
+            all = true;
+            break;
+        case 'h':
+            usage(0);
+        case 't':
+            errno = 0;
+            threads = strtol(optarg, &p, 10);
+            if (errno != 0 || *p != '\0' || threads < 1)
+                die("invalid thread count %s", optarg);
+            break;
+        default:
+            usage(1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 1)
+        usage(1);
+    if (threads == 0) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads < 1)
+            threads = 1;
+    }
+
+    /* Map the file of passwords. */
+    fd = open(argv[0], O_RDONLY);
+    if (fd < 0)
+        sysdie("cannot open %s", argv[0]);
+    if (fstat(fd, &st) < 0)
+        sysdie("cannot stat %s", argv[0]);
+    map = NULL;
+    if (st.st_size > 0) {
+        map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED)
+            sysdie("cannot map %s", argv[0]);
+        madvise((void *) map, (size_t) st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    /*
+     * Set up the workers, splitting the file into one chunk per thread.  Each
+     * split point is moved forward to the start of the next line.
+     */
+    workers = xcalloc((size_t) threads, sizeof(*workers));
+    start = map;
+    end = (map == NULL) ? NULL : map + st.st_size;
+    for (i = 0; i < (size_t) threads; i++) {
+        workers[i].all = all;
+        workers[i].start = start;
+        if (i == (size_t) threads - 1 || start == end)
+            split = end;
+        else {
+            split = start + (end - start) / (long) (threads - i);
+            split = memchr(split, '\n', (size_t) (end - split));
+            split = (split == NULL) ? end : split + 1;
+        }
+        workers[i].end = split;
+        start = split;
+
+        /* Each thread gets its own contexts. */
+        code = krb5_init_context(&workers[i].ctx);
+        if (code != 0)
+            die_krb5(workers[i].ctx, code, "cannot create Kerberos context");
+        code = strength_init(workers[i].ctx, NULL, &workers[i].data);
+        if (code != 0)
+            die_krb5(workers[i].ctx, code,
+                     "cannot initialize strength checking");
+        workers[i].lock = &lock;
+    }
+
+    /* Check all of the passwords. */
+    started = strength_timestamp();
+    for (i = 0; i < (size_t) threads; i++) {
+        status = pthread_create(&workers[i].thread, NULL, run_worker,
+                                &workers[i]);
+        if (status != 0) {
+            errno = status;
+            sysdie("cannot create thread");
+        }
+    }
+    for (i = 0; i < (size_t) threads; i++)
+        pthread_join(workers[i].thread, NULL);
+    report(workers, (size_t) threads, strength_timestamp() - started);
+
+    /* Clean up. */
+    for (i = 0; i < (size_t) threads; i++) {
+        strength_close(workers[i].ctx, workers[i].data);
+        krb5_free_context(workers[i].ctx);
+        for (j = 0; j < workers[i].reasons.count; j++)
+            free(workers[i].reasons.reasons[j].reason);
+        free(workers[i].reasons.reasons);
+    }
+    free(workers);
+    if (map != NULL)
+        munmap((void *) map, (size_t) st.st_size);
+    exit(0);
+}
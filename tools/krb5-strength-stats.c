@@ -0,0 +1,133 @@
+/*
+ * Report or reset the shared password check statistics.
+ *
+ * Maps the statistics file written by the password strength checks when
+ * stats_file is set in krb5.conf and prints the number of calls, rejections,
+ * and average time for each check, optionally with a histogram of the time
+ * taken.  It can also reset all of the counters.  The file is read directly,
+ * so this does not need to communicate with kadmind or any other process
+ * doing checks.
+ *
+ * Written by Russ Allbery <eagle@eyrie.org>
+ * Copyright 2026 Russ Allbery <eagle@eyrie.org>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <config.h>
+#include <portable/system.h>
+
+#include <errno.h>
+
+#include <plugin/internal.h>
+#include <util/macros.h>
+#include <util/messages.h>
+
+/* Usage message. */
+static const char usage_message[] = "\
+Usage: krb5-strength-stats [-hHr] <file>\n\
+\n\
+Options:\n\
+    -h          Print this usage message and exit\n\
+    -H          Also print a histogram of the time taken by each check\n\
+    -r          Reset all counters after printing them\n";
+
+
+/*
+ * Print usage information and exit with the given status.
+ */
+__attribute__((__noreturn__)) static void
+usage(int status)
+{
+    fprintf((status == 0) ? stdout : stderr, "%s", usage_message);
+    exit(status);
+}
+
+
+/*
+ * Print the counters for one check, skipping checks that have never been run.
+ * If histogram is true, follow with the non-empty buckets of the histogram
+ * of times, one per line.
+ */
+static void
+print_counters(const struct strength_stats_counters *counters, bool histogram)
+{
+    char name[STRENGTH_STATS_NAME + 1];
+    double average;
+    size_t i;
+
+    if (counters->calls == 0)
+        return;
+    memcpy(name, counters->name, STRENGTH_STATS_NAME);
+    name[STRENGTH_STATS_NAME] = '\0';
+    average = (double) counters->usec / (double) counters->calls;
+    printf("%-12s %12llu %12llu %12.1f\n", name,
+           (unsigned long long) counters->calls,
+           (unsigned long long) counters->rejects, average);
+    if (!histogram)
+        return;
+    for (i = 0; i < STRENGTH_STATS_BUCKETS; i++) {
+        if (counters->latency[i] == 0)
+            continue;
+        if (i == STRENGTH_STATS_BUCKETS - 1)
+            printf("    >= %10llu usec %12llu\n", 1ULL << (i - 1),
+                   (unsigned long long) counters->latency[i]);
+        else
+            printf("    <  %10llu usec %12llu\n", 1ULL << i,
+                   (unsigned long long) counters->latency[i]);
+    }
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    struct strength_stats *stats;
+    bool histogram = false;
+    bool reset = false;
+    size_t i;
+    int option;
+
+    message_program_name = "krb5-strength-stats";
+
+    /* Parse options. */
+    while ((option = getopt(argc, argv, "hHr")) != EOF) {
+        switch (option) {
+        case 'h':
+            usage(0);
+        case 'H':
+            histogram = true;
+            break;
+        case 'r':
+            reset = true;
+            break;
+        default:
+            usage(1);
+        }
+    }
+    argc -= optind;
+    argv += optind;
+    if (argc != 1)
+        usage(1);
+
+    /* Map the statistics file. */
+    stats = strength_stats_open(argv[0], NULL, reset);
+    if (stats == NULL) {
+        if (errno == EINVAL)
+            die("%s is not a krb5-strength statistics file", argv[0]);
+        sysdie("cannot open %s", argv[0]);
+    }
+
+    /* Print the counters for the whole check and then for each check. */
+    printf("%-12s %12s %12s %12s\n", "check", "calls", "rejects",
+           "avg usec");
+    print_counters(&stats->total, histogram);
+    for (i = 0; i < ARRAY_SIZE(stats->stage); i++)
+        print_counters(&stats->stage[i], histogram);
+
+    /* Reset the counters if requested. */
+    if (reset)
+        strength_stats_reset(stats);
+    strength_stats_close(stats);
+    exit(0);
+}